@@ -0,0 +1,157 @@
+///
+/// Vulkan Shadows
+/// Author: Fedor Vorobev
+///
+/// Edge adjacency construction for triangle lists.
+///
+#include <bit>
+#include <unordered_map>
+#include "AdjacencyBuilder.hpp"
+#include "WorkerPool.hpp"
+
+void AdjacencyBuilder::buildHashed(const uint32_t* indices, uint32_t indexCount, std::vector<AdjacentEdge>& out) {
+    std::unordered_map<Edge, OppositeVertices<4>> edgeMap;
+
+    // Reserve buckets to reduce the amount of rehashes.
+    edgeMap.reserve(indexCount);
+
+    for (uint32_t t = 0; t + 2 < indexCount; t += 3) {
+        uint32_t i0 = indices[t+0];
+        uint32_t i1 = indices[t+1];
+        uint32_t i2 = indices[t+2];
+        edgeMap[Edge(i0, i1)].push_back(i2);
+        edgeMap[Edge(i1, i2)].push_back(i0);
+        edgeMap[Edge(i2, i0)].push_back(i1);
+    }
+
+    out.clear();
+    out.reserve(edgeMap.size());
+    for (const auto& pair : edgeMap) {
+        out.emplace_back(pair.first).opposite = pair.second;
+    }
+    // Same order as the sorted builder, the map's order depends on the
+    // standard library.
+    std::sort(out.begin(), out.end(), [](const AdjacentEdge& x, const AdjacentEdge& y) {
+        return x.edge.first != y.edge.first
+             ? x.edge.first  < y.edge.first
+             : x.edge.second < y.edge.second;
+    });
+}
+
+void AdjacencyBuilder::buildSorted(const uint32_t* indices, uint32_t indexCount, std::vector<AdjacentEdge>& out) {
+    out.clear();
+
+    const uint32_t recordCount = (indexCount / 3) * 3;
+    if (recordCount == 0) {
+        return;
+    }
+
+    WorkerPool& pool = WorkerPool::get();
+    const uint32_t chunkCount = std::clamp(recordCount / MIN_RECORDS_PER_CHUNK, 1u, pool.getThreadCount());
+    const auto chunkBegin = [&](uint32_t c) { return uint32_t(uint64_t(recordCount) * c / chunkCount); };
+
+    records.resize(recordCount);
+    scratch.resize(recordCount);
+    histograms.resize(chunkCount * 256);
+    chunkBits.assign(chunkCount, 0);
+
+    // Emit one record per triangle corner. Every record keeps the slot of
+    // its corner, so the opposite vertices of an edge stay in triangle order
+    // through the (stable) sort below.
+    pool.run(chunkCount, [&](uint32_t c) {
+        uint32_t bits = 0;
+        for (uint32_t i = chunkBegin(c); i < chunkBegin(c+1); ++i) {
+            uint32_t t  = i - i % 3;
+            uint32_t a  = indices[t + (i % 3)];
+            uint32_t b  = indices[t + (i + 1) % 3];
+            uint32_t o  = indices[t + (i + 2) % 3];
+            Edge     e(a, b);
+            records[i] = { (uint64_t(e.first) << 32) | e.second, o, 0 };
+            bits |= a | b;
+        }
+        chunkBits[c] = bits;
+    });
+
+    // Only sort the digits that can actually differ between the keys.
+    uint32_t usedBits = 0;
+    for (uint32_t bits : chunkBits) {
+        usedBits |= bits;
+    }
+    const uint32_t indexBits = std::bit_width(usedBits);
+
+    EdgeRecord* src = records.data();
+    EdgeRecord* dst = scratch.data();
+    for (uint32_t half = 0; half < 2; ++half) {
+        for (uint32_t shift = 0; shift < indexBits; shift += 8) {
+            const uint32_t keyShift = half * 32 + shift;
+
+            pool.run(chunkCount, [&](uint32_t c) {
+                uint32_t* histogram = &histograms[c * 256];
+                std::fill(histogram, histogram + 256, 0);
+                for (uint32_t i = chunkBegin(c); i < chunkBegin(c+1); ++i) {
+                    histogram[(src[i].key >> keyShift) & 0xFF]++;
+                }
+            });
+
+            // Turn the counts into scatter offsets. Digit-major order keeps
+            // the records of earlier chunks in front, which keeps the sort stable.
+            bool     allSame = false;
+            uint32_t offset  = 0;
+            for (uint32_t d = 0; d < 256; ++d) {
+                uint32_t digitTotal = 0;
+                for (uint32_t c = 0; c < chunkCount; ++c) {
+                    uint32_t count = histograms[c * 256 + d];
+                    histograms[c * 256 + d] = offset;
+                    offset     += count;
+                    digitTotal += count;
+                }
+                if (digitTotal == recordCount) {
+                    allSame = true;
+                }
+            }
+            if (allSame) {
+                continue; // Nothing to reorder for this digit.
+            }
+
+            pool.run(chunkCount, [&](uint32_t c) {
+                uint32_t* histogram = &histograms[c * 256];
+                for (uint32_t i = chunkBegin(c); i < chunkBegin(c+1); ++i) {
+                    dst[histogram[(src[i].key >> keyShift) & 0xFF]++] = src[i];
+                }
+            });
+            std::swap(src, dst);
+        }
+    }
+
+    // Group the runs of equal keys.
+    out.reserve(recordCount / 2);
+    for (uint32_t i = 0; i < recordCount;) {
+        const uint64_t key = src[i].key;
+        auto& adjacent = out.emplace_back(Edge(uint32_t(key >> 32), uint32_t(key)));
+        for (; i < recordCount && src[i].key == key; ++i) {
+            adjacent.opposite.push_back(src[i].opposite);
+        }
+    }
+}
+
+bool AdjacencyBuilder::compare(const std::vector<AdjacentEdge>& a, const std::vector<AdjacentEdge>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        const auto& x = a[i];
+        const auto& y = b[i];
+        if (x.edge.first != y.edge.first || x.edge.second != y.edge.second) {
+            return false;
+        }
+        if (x.opposite.size() != y.opposite.size()) {
+            return false;
+        }
+        for (uint32_t j = 0; j < x.opposite.size(); ++j) {
+            if (x.opposite[j] != y.opposite[j]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
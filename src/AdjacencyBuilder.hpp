@@ -0,0 +1,115 @@
+///
+/// Vulkan Shadows
+/// Author: Fedor Vorobev
+///
+/// Edge adjacency construction for triangle lists.
+///
+/// For every unique edge of a triangle list, collects the vertices opposite
+/// to the edge in each triangle that shares it. Two methods are available:
+///
+/// - Hashed: every edge is inserted into a hash map. This is the original
+///   approach and is kept for comparison.
+/// - Sorted: every (edge, opposite vertex) pair is packed into a 64-bit edge
+///   key with the opposite vertex attached, the pairs are radix-sorted across
+///   the worker pool, and runs of equal keys are grouped linearly.
+///
+/// Both produce the same edge list: edges sorted by their vertex indices,
+/// with the opposite vertices in the order of the triangles they come from.
+///
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+// Once std::inplace_vector becomes widely available with C++26, this structure
+// can be cut altogether.
+template<size_t max>
+struct OppositeVertices {
+    OppositeVertices() : count(0), data{} {}
+    ~OppositeVertices() = default;
+    void push_back(uint32_t index) {
+        if (count >= max) {
+            throw std::runtime_error("Too many opposite vertices.");
+        }
+        data[count++] = index;
+    }
+    void clear() {
+        count = 0;
+    }
+    uint32_t operator[](uint32_t index) const {
+        return data[index];
+    }
+    uint32_t  size()  const { return count;        }
+    uint32_t* begin()       { return &data[0];     }
+    uint32_t* end()         { return &data[count]; }
+
+    uint32_t count;
+    uint32_t data[max];
+};
+
+union Edge {
+    Edge(uint32_t f, uint32_t s)
+        : first(std::min(f, s)), second(std::max(f, s))
+    {}
+
+    uint32_t indices[2];
+    struct { uint32_t first, second; };
+    bool operator==(const Edge& other) const {
+        return (first == other.first  && second == other.second)
+            || (first == other.second && second == other.first);
+    }
+};
+
+template<>
+struct std::hash<Edge> {
+    std::size_t operator()(const Edge& e) const {
+        // Keep commutative.
+        // Hash combination function taken from the boost library.
+        // (See: https://www.boost.org/doc/libs/1_43_0/doc/html/hash/reference.html#boost.hash_combine)
+        uint32_t first  = std::min(e.first, e.second);
+        uint32_t second = std::max(e.first, e.second);
+        return first ^ (second + 0x9e3779b9 + (first << 6) + (first >> 2));
+    }
+};
+
+// Limiting ourselves to a maximum amount of opposite vertices
+// to avoid an overhead of having to manage dynamic arrays for each edge.
+// The maximum we can pass to the geometry shader via the "triangle with adjacency"
+// primitive is 4, hence the maximum amount here.
+struct AdjacentEdge {
+    AdjacentEdge(const Edge& edge) : edge(edge) {}
+
+    Edge                edge;
+    OppositeVertices<4> opposite;
+};
+
+class AdjacencyBuilder {
+public:
+    /// Builds the edge list using an unordered_map. Edges come out sorted by
+    /// their vertex indices, same as with buildSorted().
+    void buildHashed(const uint32_t* indices, uint32_t indexCount, std::vector<AdjacentEdge>& out);
+
+    /// Builds the edge list by radix-sorting packed edge keys. Edges come out
+    /// sorted by their vertex indices.
+    void buildSorted(const uint32_t* indices, uint32_t indexCount, std::vector<AdjacentEdge>& out);
+
+    /// Returns true if both edge lists contain the same edges in the same
+    /// order with the same opposite vertices in the same order.
+    static bool compare(const std::vector<AdjacentEdge>& a, const std::vector<AdjacentEdge>& b);
+private:
+    // Anything smaller than this isn't worth waking up the worker threads for.
+    static constexpr uint32_t MIN_RECORDS_PER_CHUNK = 1 << 15;
+
+    struct EdgeRecord {
+        uint64_t key;      // (first << 32) | second
+        uint32_t opposite;
+        uint32_t padding;
+    };
+
+    std::vector<EdgeRecord> records;
+    std::vector<EdgeRecord> scratch;
+    std::vector<uint32_t>   histograms;
+    std::vector<uint32_t>   chunkBits;
+};
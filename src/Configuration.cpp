@@ -42,6 +42,8 @@ Configuration::Configuration(int argc, char** argv)
     , cameraZFar(1000.0f)
     , cameraFov(45.0f)
     , shadowTech(eShadowTech_None)
+    , indirectDraws(true)
+    , gpuCulling(true)
     , svMethod(eSVMethod_SilhoutteDepthFail)
     , svDebugOverlay(false)
     , smResolution(512)
@@ -50,6 +52,22 @@ Configuration::Configuration(int argc, char** argv)
     , smZNear(0.1f)
     , smPCFSampler(true)
     , smCullFrontFaces(true)
+    , smMultiview(true)
+    , smCache(true)
+    , smStaticLayer(true)
+    , smAtlas(false)
+    , smAtlasSize(4096)
+    , smFaceBudget(0)
+    , edgeBuilder(eEdgeBuilder_Sorted)
+    , weld(false)
+    , weldTolerance(0.0f)
+    , weldStats(false)
+    , compactEdges(false)
+    , pruneEdges(false)
+    , pruneAngle(0.0f)
+    , vertexFormat(eVertexFlags_Normal | eVertexFlags_TexCoord)
+    , optimizeMeshes(false)
+    , geometryCache(false)
 {
     for (int i = 1; i < argc; ++i) {
         const char* arg = argv[i];
@@ -78,6 +96,14 @@ Configuration::Configuration(int argc, char** argv)
                 svDebugOverlay = false;
             } else if (strcmp(option, "sv-debug-overlay") == 0) {
                 svDebugOverlay = true;
+            } else if (strcmp(option, "no-indirect-draws") == 0) {
+                indirectDraws = false;
+            } else if (strcmp(option, "indirect-draws") == 0) {
+                indirectDraws = true;
+            } else if (strcmp(option, "no-gpu-culling") == 0) {
+                gpuCulling = false;
+            } else if (strcmp(option, "gpu-culling") == 0) {
+                gpuCulling = true;
             } else if (strcmp(option, "no-sm-pcf") == 0) {
                 smPCFSampler = false;
             } else if (strcmp(option, "sm-pcf") == 0) {
@@ -86,6 +112,44 @@ Configuration::Configuration(int argc, char** argv)
                 smCullFrontFaces = false;
             } else if (strcmp(option, "sm-cull-front") == 0) {
                 smCullFrontFaces = true;
+            } else if (strcmp(option, "no-sm-multiview") == 0) {
+                smMultiview = false;
+            } else if (strcmp(option, "sm-multiview") == 0) {
+                smMultiview = true;
+            } else if (strcmp(option, "no-sm-cache") == 0) {
+                smCache = false;
+            } else if (strcmp(option, "sm-cache") == 0) {
+                smCache = true;
+            } else if (strcmp(option, "no-sm-static-layer") == 0) {
+                smStaticLayer = false;
+            } else if (strcmp(option, "sm-static-layer") == 0) {
+                smStaticLayer = true;
+            } else if (strcmp(option, "no-sm-atlas") == 0) {
+                smAtlas = false;
+            } else if (strcmp(option, "sm-atlas") == 0) {
+                smAtlas = true;
+            } else if (strcmp(option, "no-weld") == 0) {
+                weld = false;
+            } else if (strcmp(option, "weld") == 0) {
+                weld = true;
+            } else if (strcmp(option, "no-compact-edges") == 0) {
+                compactEdges = false;
+            } else if (strcmp(option, "compact-edges") == 0) {
+                compactEdges = true;
+            } else if (strcmp(option, "no-prune-edges") == 0) {
+                pruneEdges = false;
+            } else if (strcmp(option, "prune-edges") == 0) {
+                pruneEdges = true;
+            } else if (strcmp(option, "no-optimize-meshes") == 0) {
+                optimizeMeshes = false;
+            } else if (strcmp(option, "optimize-meshes") == 0) {
+                optimizeMeshes = true;
+            } else if (strcmp(option, "no-geometry-cache") == 0) {
+                geometryCache = false;
+            } else if (strcmp(option, "geometry-cache") == 0) {
+                geometryCache = true;
+            } else if (strcmp(option, "weld-stats") == 0) {
+                weldStats = true;
             } else if (strcmp(option, "width") == 0) {
                 if (optionArg = fetch_option_arg(i, argc, argv)) {
                     width = atoi(optionArg);
@@ -187,6 +251,10 @@ Configuration::Configuration(int argc, char** argv)
                         svMethod   = eSVMethod_SilhoutteDepthFail;
                     } else if (strcmp(optionArg, "sm") == 0) {
                         shadowTech = eShadowTech_ShadowMapping;
+                    } else if (strcmp(optionArg, "dpsm") == 0) {
+                        shadowTech = eShadowTech_DualParaboloid;
+                    } else if (strcmp(optionArg, "tsm") == 0) {
+                        shadowTech = eShadowTech_Tetrahedral;
                     } else {
                         shadowTech = eShadowTech_None;
                     }
@@ -195,6 +263,14 @@ Configuration::Configuration(int argc, char** argv)
                 if (optionArg = fetch_option_arg(i, argc, argv)) {
                     smResolution = atoi(optionArg);
                 }
+            } else if (strcmp(option, "sm-atlas-size") == 0) {
+                if (optionArg = fetch_option_arg(i, argc, argv)) {
+                    smAtlasSize = atoi(optionArg);
+                }
+            } else if (strcmp(option, "sm-face-budget") == 0) {
+                if (optionArg = fetch_option_arg(i, argc, argv)) {
+                    smFaceBudget = atoi(optionArg);
+                }
             } else if (strcmp(option, "sm-bias-constant") == 0) {
                 if (optionArg = fetch_option_arg(i, argc, argv)) {
                     smBiasConstant = atof(optionArg);
@@ -207,6 +283,33 @@ Configuration::Configuration(int argc, char** argv)
                 if (optionArg = fetch_option_arg(i, argc, argv)) {
                     smZNear = atof(optionArg);
                 }
+            } else if (strcmp(option, "edge-builder") == 0) {
+                if (optionArg = fetch_option_arg(i, argc, argv)) {
+                    if (strcmp(optionArg, "hashed") == 0) {
+                        edgeBuilder = eEdgeBuilder_Hashed;
+                    } else if (strcmp(optionArg, "compare") == 0) {
+                        edgeBuilder = eEdgeBuilder_Compare;
+                    } else {
+                        edgeBuilder = eEdgeBuilder_Sorted;
+                    }
+                }
+            } else if (strcmp(option, "prune-angle") == 0) {
+                if (optionArg = fetch_option_arg(i, argc, argv)) {
+                    pruneAngle = atof(optionArg);
+                }
+            } else if (strcmp(option, "vertex-format") == 0) {
+                if (optionArg = fetch_option_arg(i, argc, argv)) {
+                    vertexFormat = eVertexFlags_Normal | eVertexFlags_TexCoord;
+                    if (strcmp(optionArg, "packed") == 0) {
+                        vertexFormat = vertexFormat | eVertexFlags_Packed;
+                    } else if (strcmp(optionArg, "quantized") == 0) {
+                        vertexFormat = vertexFormat | eVertexFlags_Packed | eVertexFlags_QuantizedPosition;
+                    }
+                }
+            } else if (strcmp(option, "weld-tolerance") == 0) {
+                if (optionArg = fetch_option_arg(i, argc, argv)) {
+                    weldTolerance = atof(optionArg);
+                }
             }
         } else {
             valid = true;
@@ -221,7 +324,19 @@ Configuration::Configuration(int argc, char** argv)
     if (test && (testFrames <= 0 || testTimeStep <= 0)) {
         valid = false;
     }
-    if (shadowTech == eShadowTech_ShadowMapping && smResolution <= 0) {
+    if (is_shadow_mapping(shadowTech) && smResolution <= 0) {
+        valid = false;
+    }
+    if (shadowTech == eShadowTech_ShadowMapping && smAtlas && smAtlasSize <= 0) {
+        valid = false;
+    }
+    if (smFaceBudget < 0) {
+        valid = false;
+    }
+    if (weldTolerance < 0) {
+        valid = false;
+    }
+    if (pruneAngle < 0 || pruneAngle >= 90) {
         valid = false;
     }
 }
@@ -235,7 +350,8 @@ void Configuration::printUsage(char* argv0) {
     std::cout << "    --width <integer>             Specifies the width of the window (default: 1280)\n";
     std::cout << "    --height <integer>            Specifies the height of the window (default: 720)\n";
     std::cout << "    --gpu-index <integer>         Specifies which GPU to use, follows order given by Vulkan (default: any)\n";
-    std::cout << "    --test / --no-test            Enables/disables test mode (default: disabled)\n";
+    std::cout << "    --test / --no-test            Enables/disables test mode, printing GPU frame times and with shadow\n";
+    std::cout << "                                  mapping an average of its passes at the end (default: disabled)\n";
     std::cout << "    --test-frames <integer>       Specifies length of the test in frames (default: 300)\n";
     std::cout << "    --test-timestep <seconds>     Specifies animation timestep in test mode (default: 16.666ms)\n";
     std::cout << "    --shadow-tech <name>          Specifies the shadow technique to use (default: none),\n";
@@ -245,14 +361,54 @@ void Configuration::printUsage(char* argv0) {
     std::cout << "                                      ssvdp - Silhoutte Shadow Volumes Depth Pass\n";
     std::cout << "                                      ssvdf - Silhoutte Shadow Volumes Depth Fail\n";
     std::cout << "                                      sm    - Shadow Mapping\n";
+    std::cout << "                                      dpsm  - Dual-Paraboloid Shadow Mapping\n";
+    std::cout << "                                      tsm   - Tetrahedral Shadow Mapping\n";
+    std::cout << "    --indirect-draws / --no-indirect-draws\n";
+    std::cout << "                                  Records scene and shadow map passes as one indirect draw per pipeline\n";
+    std::cout << "                                  instead of a draw per primitive group. Only together with GPU culling,\n";
+    std::cout << "                                  otherwise the draws stay direct and culled on the CPU (default: enabled)\n";
+    std::cout << "    --gpu-culling / --no-gpu-culling\n";
+    std::cout << "                                  Culls indirect draws against the view frustum in a compute pass\n";
+    std::cout << "                                  before each scene and shadow map pass (default: enabled)\n";
     std::cout << "\n";
     std::cout << "Shadow mapping options:\n";
     std::cout << "    --sm-resolution    <integer>           Specifies the resolution of the shadow map (default: 512)\n";
+    std::cout << "    --sm-atlas-size    <integer>           Specifies the size of the shadow atlas, rounded up to a power of two (default: 4096).\n";
+    std::cout << "    --sm-face-budget   <integer>           Specifies how many changed shadow map faces are drawn per frame, 0 for all (default: 0).\n";
     std::cout << "    --sm-bias-constant <number>            Specifies the constant factor for shadow map bias (default: 512).\n";
     std::cout << "    --sm-bias-slope    <number>            Specifies the slope factor for shadow map bias (default: 4).\n";
     std::cout << "    --sm-z-near        <number>            Specifies the z-near coordinate for shadow maps (default: 0.1).\n";
     std::cout << "    --sm-pcf / --no-sm-pcf                 Enables/disables usage of a 2x2 HW PCF sampler in shadow mapping (default: enabled).\n";
     std::cout << "    --sm-cull-front / --no-sm-cull-front   Enables/disables culling of front faces in shadow maps (default: enabled).\n";
+    std::cout << "    --sm-multiview / --no-sm-multiview     Enables/disables drawing all six cube faces in one multiview pass (default: enabled).\n";
+    std::cout << "    --sm-cache / --no-sm-cache             Enables/disables only redrawing shadow map faces something moved in (default: enabled).\n";
+    std::cout << "    --sm-static-layer / --no-sm-static-layer\n";
+    std::cout << "                                           Enables/disables keeping the casters no animation moves in a separate cached shadow map (default: enabled).\n";
+    std::cout << "    --sm-atlas / --no-sm-atlas             Enables/disables drawing all lights to tiles of one shadow atlas, sized by screen coverage (default: disabled).\n";
+    std::cout << "\n";
+    std::cout << "Mesh import options:\n";
+    std::cout << "    --edge-builder <name>                  Specifies how edge adjacency is built for silhouette shadow volumes (default: sorted),\n";
+    std::cout << "                                           Available variants:\n";
+    std::cout << "                                               sorted  - Parallel radix sort of packed edge keys\n";
+    std::cout << "                                               hashed  - Hash map of edges\n";
+    std::cout << "                                               compare - Run both, print timings and check that the output matches\n";
+    std::cout << "    --compact-edges / --no-compact-edges   Stores edges with two faces as lines with adjacency, 4 instead of 6 indices (default: disabled).\n";
+    std::cout << "    --prune-edges / --no-prune-edges       Drops edges between coplanar faces, they are never part of a silhouette,\n";
+    std::cout << "                                           printing the edgeIndexCount reduction per mesh (default: disabled).\n";
+    std::cout << "    --prune-angle <degrees>                Specifies the max angle between face normals for them to count as coplanar, 0 means exact (default: 0).\n";
+    std::cout << "    --weld / --no-weld                     Enables/disables welding of equal positions before building edges (default: disabled).\n";
+    std::cout << "    --weld-tolerance <number>              Specifies the distance under which positions are welded, 0 means exact (default: 0).\n";
+    std::cout << "    --weld-stats                           Prints how many edges and volume quads welding removes per mesh.\n";
+    std::cout << "    --optimize-meshes / --no-optimize-meshes\n";
+    std::cout << "                                           Reorders triangles and vertices for the vertex cache and less overdraw,\n";
+    std::cout << "                                           printing ACMR/ATVR per mesh before and after (default: disabled).\n";
+    std::cout << "    --geometry-cache / --no-geometry-cache Stores processed meshes in <file>.geomcache and reuses them while the model\n";
+    std::cout << "                                           and the options above stay the same (default: disabled).\n";
+    std::cout << "    --vertex-format <name>                 Specifies how vertices are stored on the GPU (default: float),\n";
+    std::cout << "                                           Available variants:\n";
+    std::cout << "                                               float     - 32 bytes, float position, normal and texcoord\n";
+    std::cout << "                                               packed    - 20 bytes, octahedral normal and half float texcoord\n";
+    std::cout << "                                               quantized - 16 bytes, packed with 16-bit positions within the mesh bounds\n";
     std::cout << "\n";
     std::cout << "Light options:\n";
     std::cout << "    --light-ignore-node             App will ignore light nodes present in the scene.\n";
@@ -7,14 +7,24 @@
 #pragma once
 
 #include "glm.hpp"
+#include "Vertex.hpp"
 
 enum eShadowTech : int {
     eShadowTech_None,
     eShadowTech_ShadowMapping,
     eShadowTech_StencilShadowVolumes,
+    eShadowTech_DualParaboloid, // Shadow mapping with two paraboloid halves per light instead of a cube.
+    eShadowTech_Tetrahedral,    // Same with the four faces of a tetrahedron in one 2D texture.
     eShadowTechCount
 };
 
+/// True for the techniques that draw the lights to shadow maps.
+inline bool is_shadow_mapping(eShadowTech tech) {
+    return tech == eShadowTech_ShadowMapping
+        || tech == eShadowTech_DualParaboloid
+        || tech == eShadowTech_Tetrahedral;
+}
+
 enum eSVMethod {
     eSVMethod_DepthPass,
     eSVMethod_DepthFail,
@@ -23,6 +33,13 @@ enum eSVMethod {
     eSVMethodCount,
 };
 
+enum eEdgeBuilder {
+    eEdgeBuilder_Sorted,  // Radix sort of packed edge keys.
+    eEdgeBuilder_Hashed,  // std::unordered_map of edges.
+    eEdgeBuilder_Compare, // Runs both, compares their output and timings.
+    eEdgeBuilderCount,
+};
+
 struct Configuration {
     Configuration(int argc, char** argv);
     static void printUsage(char* argv0);
@@ -56,6 +73,8 @@ struct Configuration {
     float     cameraFov;
 
     eShadowTech shadowTech;
+    bool        indirectDraws;
+    bool        gpuCulling;
     eSVMethod   svMethod;
     bool        svDebugOverlay;
     int         smResolution;
@@ -64,4 +83,21 @@ struct Configuration {
     float       smZNear;
     bool        smPCFSampler;
     bool        smCullFrontFaces;
+    bool        smMultiview;
+    bool        smCache;
+    bool        smStaticLayer;
+    bool        smAtlas;
+    int         smAtlasSize;
+    int         smFaceBudget;
+
+    eEdgeBuilder edgeBuilder;
+    bool         weld;
+    float        weldTolerance;
+    bool         weldStats;
+    bool         compactEdges;
+    bool         pruneEdges;
+    float        pruneAngle;
+    eVertexFlags vertexFormat;
+    bool         optimizeMeshes;
+    bool         geometryCache;
 };
\ No newline at end of file
@@ -0,0 +1,74 @@
+///
+/// Vulkan Shadows
+/// Author: Fedor Vorobev
+///
+/// View frustum planes for culling bounding boxes on the CPU.
+///
+#pragma once
+
+#include "glm.hpp"
+
+/// Axis-aligned bounding box.
+struct Aabb {
+    glm::vec3 min;
+    glm::vec3 max;
+
+    /// Box around this one after an affine transform.
+    Aabb transformed(const glm::mat4& m) const {
+        glm::vec3 center = glm::vec3(m * glm::vec4((min + max) * 0.5f, 1.0f));
+        glm::vec3 extent = (max - min) * 0.5f;
+        glm::vec3 newExtent(0.0f);
+        for (int c = 0; c < 3; ++c) {
+            newExtent += glm::abs(glm::vec3(m[c])) * extent[c];
+        }
+        return { center - newExtent, center + newExtent };
+    }
+
+    bool intersectsSphere(const glm::vec3& center, float radius) const {
+        glm::vec3 d = center - glm::clamp(center, min, max);
+        return glm::dot(d, d) <= radius * radius;
+    }
+};
+
+class Frustum {
+public:
+    /// Extracts the planes from a projection*view matrix with a [0, 1]
+    /// depth range (Gribb & Hartmann).
+    Frustum(const glm::mat4& projView) {
+        glm::mat4 t = glm::transpose(projView);
+        planes[0] = t[3] + t[0]; // Left
+        planes[1] = t[3] - t[0]; // Right
+        planes[2] = t[3] + t[1]; // Bottom
+        planes[3] = t[3] - t[1]; // Top
+        planes[4] = t[2];        // Near
+        planes[5] = t[3] - t[2]; // Far
+    }
+
+    /// False only if the box is fully outside of one of the planes, so
+    /// some boxes near the corners pass even though they are outside.
+    bool intersects(const Aabb& box) const {
+        for (const auto& plane : planes) {
+            glm::vec3 farthest = {
+                plane.x >= 0.0f ? box.max.x : box.min.x,
+                plane.y >= 0.0f ? box.max.y : box.min.y,
+                plane.z >= 0.0f ? box.max.z : box.min.z,
+            };
+            if (glm::dot(glm::vec3(plane), farthest) + plane.w < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Same conservative test for a sphere.
+    bool intersectsSphere(const glm::vec3& center, float radius) const {
+        for (const auto& plane : planes) {
+            if (glm::dot(glm::vec3(plane), center) + plane.w < -radius * glm::length(glm::vec3(plane))) {
+                return false;
+            }
+        }
+        return true;
+    }
+private:
+    glm::vec4 planes[6];
+};
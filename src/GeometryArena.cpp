@@ -0,0 +1,323 @@
+///
+/// Vulkan Shadows
+/// Author: Fedor Vorobev
+///
+/// Scene-wide storage for mesh geometry.
+///
+#include <algorithm>
+#include <stdexcept>
+#include "GeometryArena.hpp"
+
+RangeAllocator::RangeAllocator(uint32_t capacity)
+    : capacity(0)
+    , used(0)
+{
+    grow(capacity);
+}
+
+bool RangeAllocator::allocate(uint32_t count, Range& out) {
+    if (count == 0) {
+        out = { 0, 0 };
+        return true;
+    }
+    for (auto it = freeRanges.begin(); it != freeRanges.end(); ++it) {
+        if (it->count >= count) {
+            out = { it->offset, count };
+            it->offset += count;
+            it->count  -= count;
+            if (it->count == 0) {
+                freeRanges.erase(it);
+            }
+            used += count;
+            return true;
+        }
+    }
+    return false;
+}
+
+void RangeAllocator::free(const Range& range) {
+    if (range.count == 0) {
+        return;
+    }
+    used -= range.count;
+
+    auto next = std::lower_bound(freeRanges.begin(), freeRanges.end(), range.offset,
+                                 [](const Range& r, uint32_t offset) { return r.offset < offset; });
+    auto it = freeRanges.insert(next, range);
+
+    // Merge with the following range.
+    auto following = it + 1;
+    if (following != freeRanges.end() && it->offset + it->count == following->offset) {
+        it->count += following->count;
+        freeRanges.erase(following);
+    }
+    // Merge with the preceding range.
+    if (it != freeRanges.begin()) {
+        auto preceding = it - 1;
+        if (preceding->offset + preceding->count == it->offset) {
+            preceding->count += it->count;
+            freeRanges.erase(it);
+        }
+    }
+}
+
+void RangeAllocator::grow(uint32_t newCapacity) {
+    if (newCapacity <= capacity) {
+        return;
+    }
+    if (!freeRanges.empty() && freeRanges.back().offset + freeRanges.back().count == capacity) {
+        freeRanges.back().count += newCapacity - capacity;
+    } else {
+        freeRanges.push_back({ capacity, newCapacity - capacity });
+    }
+    capacity = newCapacity;
+}
+
+void RangeAllocator::reset(uint32_t newUsed) {
+    used = newUsed;
+    freeRanges.clear();
+    if (used < capacity) {
+        freeRanges.push_back({ used, capacity - used });
+    }
+}
+
+uint32_t RangeAllocator::getLargestFree() const {
+    uint32_t largest = 0;
+    for (const auto& r : freeRanges) {
+        largest = std::max(largest, r.count);
+    }
+    return largest;
+}
+
+GeometryArena::GeometryArena(Renderer& renderer,
+                             uint32_t  vertexStride,
+                             uint32_t  positionStride,
+                             uint64_t  vertexCapacity,
+                             uint64_t  indexCapacity,
+                             uint64_t  edgeCapacity)
+    : renderer(renderer)
+{
+    initPool(vertexPool, { vertexStride, positionStride }, GpuBuffer::USAGE_VERTEXBUFFER, vertexCapacity);
+    initPool(indexPool,  { sizeof(uint32_t) },             GpuBuffer::USAGE_INDEXBUFFER,  indexCapacity);
+    initPool(edgePool,   { sizeof(uint32_t) },             GpuBuffer::USAGE_INDEXBUFFER,  edgeCapacity);
+}
+
+void GeometryArena::initPool(Pool& pool, std::initializer_list<uint32_t> unitSizes, VkBufferUsageFlags usage, uint64_t capacity) {
+    pool.usage = usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT; // Source for growing and compaction.
+    for (uint32_t unitSize : unitSizes) {
+        pool.streams.push_back({ nullptr, unitSize });
+    }
+    pool.ranges = RangeAllocator(std::max(1u, toUnits(pool, capacity)));
+    for (auto& stream : pool.streams) {
+        stream.buffer = std::make_unique<GpuBuffer>(renderer, uint64_t(pool.ranges.getCapacity()) * stream.unitSize, pool.usage);
+    }
+}
+
+uint32_t GeometryArena::toUnits(const Pool& pool, uint64_t bytes) {
+    const uint32_t unitSize = pool.streams[0].unitSize;
+    uint64_t units = (bytes + unitSize - 1) / unitSize;
+    if (units > UINT32_MAX) {
+        throw std::runtime_error("Geometry arena allocation is too large.");
+    }
+    return uint32_t(units);
+}
+
+void GeometryArena::growPool(Pool& pool, uint32_t minFreeUnits) {
+    const uint32_t oldCapacity = pool.ranges.getCapacity();
+    const uint64_t newCapacity = std::max(uint64_t(oldCapacity) * 2, uint64_t(oldCapacity) + minFreeUnits);
+    if (newCapacity > UINT32_MAX) {
+        throw std::runtime_error("Geometry arena is out of space.");
+    }
+
+    // Growing only happens while loading, with no frame in flight.
+    // recordOneTime() waits for the queue to go idle, so the old buffers
+    // can be dropped right after the copies.
+    std::vector<std::unique_ptr<GpuBuffer>> grown;
+    for (auto& stream : pool.streams) {
+        grown.push_back(std::make_unique<GpuBuffer>(renderer, newCapacity * stream.unitSize, pool.usage));
+    }
+    renderer.recordOneTime([&](VkCommandBuffer cmdbuf) {
+        for (uint32_t s = 0; s < pool.streams.size(); ++s) {
+            grown[s]->copyFrom(cmdbuf, *pool.streams[s].buffer, uint64_t(oldCapacity) * pool.streams[s].unitSize);
+        }
+    });
+    for (uint32_t s = 0; s < pool.streams.size(); ++s) {
+        pool.streams[s].buffer = std::move(grown[s]);
+    }
+    pool.ranges.grow(uint32_t(newCapacity));
+}
+
+void GeometryArena::reserve(uint64_t vertexBytes, uint64_t indexBytes, uint64_t edgeBytes) {
+    const std::pair<Pool*, uint64_t> requests[] = {
+        { &vertexPool, vertexBytes },
+        { &indexPool,  indexBytes  },
+        { &edgePool,   edgeBytes   },
+    };
+    for (auto [pool, bytes] : requests) {
+        uint32_t units = toUnits(*pool, bytes);
+        if (pool->ranges.getLargestFree() < units) {
+            growPool(*pool, units);
+        }
+    }
+}
+
+GeometryArena::Handle GeometryArena::allocate(uint64_t vertexBytes, uint64_t indexBytes, uint64_t edgeBytes) {
+    Allocation allocation;
+    const std::pair<Pool*, RangeAllocator::Range*> targets[] = {
+        { &vertexPool, &allocation.vertices },
+        { &indexPool,  &allocation.indices  },
+        { &edgePool,   &allocation.edges    },
+    };
+    const uint64_t sizes[] = { vertexBytes, indexBytes, edgeBytes };
+    for (uint32_t i = 0; i < 3; ++i) {
+        auto [pool, range] = targets[i];
+        uint32_t units = toUnits(*pool, sizes[i]);
+        if (!pool->ranges.allocate(units, *range)) {
+            growPool(*pool, units);
+            pool->ranges.allocate(units, *range);
+        }
+    }
+
+    Handle handle;
+    if (!freeHandles.empty()) {
+        handle = freeHandles.back();
+        freeHandles.pop_back();
+        allocations[handle] = allocation;
+        live[handle] = true;
+    } else {
+        handle = Handle(allocations.size());
+        allocations.push_back(allocation);
+        live.push_back(true);
+    }
+    return handle;
+}
+
+void GeometryArena::free(Handle handle) {
+    if (handle >= allocations.size() || !live[handle]) {
+        return;
+    }
+    const auto& allocation = allocations[handle];
+    vertexPool.ranges.free(allocation.vertices);
+    indexPool.ranges.free(allocation.indices);
+    edgePool.ranges.free(allocation.edges);
+    live[handle] = false;
+    freeHandles.push_back(handle);
+}
+
+void GeometryArena::compactPool(VkCommandBuffer cmdbuf, Pool& pool, RangeAllocator::Range Allocation::* member,
+                                std::vector<std::unique_ptr<GpuBuffer>>& retired) {
+    // Pack live ranges in their current order.
+    std::vector<Handle> order;
+    for (Handle h = 0; h < allocations.size(); ++h) {
+        if (live[h] && (allocations[h].*member).count > 0) {
+            order.push_back(h);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](Handle a, Handle b) {
+        return (allocations[a].*member).offset < (allocations[b].*member).offset;
+    });
+
+    // Regions in units, scaled per stream below.
+    std::vector<VkBufferCopy> regions;
+    uint32_t packed = 0;
+    bool     moved  = false;
+    for (Handle h : order) {
+        auto& range = allocations[h].*member;
+        regions.push_back({
+            .srcOffset = range.offset,
+            .dstOffset = packed,
+            .size      = range.count,
+        });
+        moved |= range.offset != packed;
+        range.offset = packed;
+        packed += range.count;
+    }
+    pool.ranges.reset(packed);
+    if (!moved) {
+        return; // Already packed, only the free space at the end changes.
+    }
+
+    for (auto& stream : pool.streams) {
+        std::vector<VkBufferCopy> scaled = regions;
+        for (auto& region : scaled) {
+            region.srcOffset *= stream.unitSize;
+            region.dstOffset *= stream.unitSize;
+            region.size      *= stream.unitSize;
+        }
+        auto compacted = std::make_unique<GpuBuffer>(renderer, stream.buffer->getSize(), pool.usage);
+        if (!scaled.empty()) {
+            vkCmdCopyBuffer(cmdbuf, *stream.buffer, *compacted, uint32_t(scaled.size()), scaled.data());
+        }
+        retired.push_back(std::move(stream.buffer));
+        stream.buffer = std::move(compacted);
+    }
+}
+
+void GeometryArena::compact() {
+    std::vector<std::unique_ptr<GpuBuffer>> retired;
+    renderer.recordOneTime([&](VkCommandBuffer cmdbuf) {
+        compactPool(cmdbuf, vertexPool, &Allocation::vertices, retired);
+        compactPool(cmdbuf, indexPool,  &Allocation::indices,  retired);
+        compactPool(cmdbuf, edgePool,   &Allocation::edges,    retired);
+    });
+    // recordOneTime() waited for the copies, the old buffers can go.
+    // With the device idle, nothing else reads them either.
+}
+
+void GeometryArena::recordUpload(VkCommandBuffer cmdbuf, GpuBuffer& src, uint64_t srcOffset, Handle handle) {
+    const auto& allocation = allocations[handle];
+    const std::pair<Pool*, const RangeAllocator::Range*> targets[] = {
+        { &vertexPool, &allocation.vertices },
+        { &indexPool,  &allocation.indices  },
+        { &edgePool,   &allocation.edges    },
+    };
+    for (auto [pool, range] : targets) {
+        for (auto& stream : pool->streams) {
+            uint64_t size = uint64_t(range->count) * stream.unitSize;
+            if (size > 0) {
+                stream.buffer->copyFrom(cmdbuf, src, size, srcOffset, uint64_t(range->offset) * stream.unitSize);
+            }
+            srcOffset += size;
+        }
+    }
+}
+
+void GeometryArena::bindVertexBuffer(VkCommandBuffer cmdbuf, uint32_t binding) const {
+    VkBuffer     buffer = *vertexPool.streams[0].buffer;
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(cmdbuf, binding, 1, &buffer, &offset);
+}
+
+void GeometryArena::bindPositionBuffer(VkCommandBuffer cmdbuf, uint32_t binding) const {
+    VkBuffer     buffer = *vertexPool.streams[1].buffer;
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(cmdbuf, binding, 1, &buffer, &offset);
+}
+
+void GeometryArena::bindIndexBuffer(VkCommandBuffer cmdbuf, VkIndexType type) const {
+    vkCmdBindIndexBuffer(cmdbuf, *indexPool.streams[0].buffer, 0, type);
+}
+
+void GeometryArena::bindEdgeBuffer(VkCommandBuffer cmdbuf, VkIndexType type) const {
+    vkCmdBindIndexBuffer(cmdbuf, *edgePool.streams[0].buffer, 0, type);
+}
+
+uint64_t GeometryArena::getUsedSize() const {
+    uint64_t size = 0;
+    for (const Pool* pool : { &vertexPool, &indexPool, &edgePool }) {
+        for (const auto& stream : pool->streams) {
+            size += uint64_t(pool->ranges.getUsed()) * stream.unitSize;
+        }
+    }
+    return size;
+}
+
+uint64_t GeometryArena::getCapacitySize() const {
+    uint64_t size = 0;
+    for (const Pool* pool : { &vertexPool, &indexPool, &edgePool }) {
+        for (const auto& stream : pool->streams) {
+            size += stream.buffer->getSize();
+        }
+    }
+    return size;
+}
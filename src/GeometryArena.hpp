@@ -0,0 +1,151 @@
+///
+/// Vulkan Shadows
+/// Author: Fedor Vorobev
+///
+/// Scene-wide storage for mesh geometry.
+///
+/// Instead of every mesh owning its own buffer, all vertices, indices and
+/// edge indices live in a few large buffers that are suballocated per mesh.
+/// Draws then only differ in firstIndex/vertexOffset, so the buffers can be
+/// bound once per pass.
+///
+/// Next to the interleaved vertices there's a position-only copy for the
+/// passes that don't need anything else. Both share the same vertex
+/// ranges, so one vertexOffset works for either.
+///
+/// Vertex ranges are counted in vertices of a fixed stride, index and edge
+/// index ranges in 4 byte units. A unit holds one 32-bit or two 16-bit
+/// indices, so meshes with either index type share the same buffers.
+///
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "GpuBuffer.hpp"
+
+/// First-fit allocator of ranges within a linear space. Only does the
+/// bookkeeping, doesn't touch any memory.
+class RangeAllocator {
+public:
+    struct Range {
+        uint32_t offset;
+        uint32_t count;
+    };
+
+    RangeAllocator(uint32_t capacity = 0);
+
+    /// Returns false if there's no free range large enough.
+    bool allocate(uint32_t count, Range& out);
+
+    /// Returns the range to the free list, merging it with its neighbours.
+    void free(const Range& range);
+
+    /// Extends the space, new space is added as free.
+    void grow(uint32_t newCapacity);
+
+    /// Marks [0, used) as allocated and the rest as free.
+    void reset(uint32_t used);
+
+    uint32_t getCapacity() const { return capacity; }
+    uint32_t getUsed()     const { return used;     }
+    uint32_t getLargestFree() const;
+private:
+    std::vector<Range> freeRanges; // Sorted by offset, never adjacent.
+    uint32_t           capacity;
+    uint32_t           used;
+};
+
+class GeometryArena {
+public:
+    using Handle = uint32_t;
+    static constexpr Handle INVALID_HANDLE = UINT32_MAX;
+
+    struct Allocation {
+        RangeAllocator::Range vertices; // in vertices
+        RangeAllocator::Range indices;  // in 4 byte units
+        RangeAllocator::Range edges;    // in 4 byte units
+    };
+
+    /// Creates the buffers with the given initial capacities in bytes.
+    /// They grow on demand. The position stream is sized to match the
+    /// vertex capacity.
+    GeometryArena(Renderer& renderer,
+                  uint32_t  vertexStride,
+                  uint32_t  positionStride,
+                  uint64_t  vertexCapacity = 16 << 20,
+                  uint64_t  indexCapacity  = 16 << 20,
+                  uint64_t  edgeCapacity   = 16 << 20);
+
+    /// Copying not allowed.
+    GeometryArena(const GeometryArena&) = delete;
+
+    /// Moving not allowed.
+    GeometryArena(GeometryArena&&) = delete;
+
+    /// Makes sure that at least the given amount of bytes can be allocated
+    /// without growing any of the buffers in between. Vertex sizes are of
+    /// the interleaved vertices, the positions follow from them.
+    void reserve(uint64_t vertexBytes, uint64_t indexBytes, uint64_t edgeBytes);
+
+    /// Allocates ranges for the vertex, position, index and edge index
+    /// data of a mesh. Growing replaces the buffers, so this is only
+    /// meant to be used while loading, when no frame is in flight.
+    Handle allocate(uint64_t vertexBytes, uint64_t indexBytes, uint64_t edgeBytes);
+
+    /// Frees all ranges of an allocation.
+    void free(Handle handle);
+
+    /// Moves all allocations to the front of the buffers to get rid of
+    /// the holes left by free(). Offsets change, so the owners have to
+    /// query them again with get() afterwards. Replaces the buffers, so
+    /// the device has to be idle, see Renderer::waitForDevice().
+    void compact();
+
+    const Allocation& get(Handle handle) const { return allocations[handle]; }
+
+    /// Records copies of vertex, position, index and edge data placed back
+    /// to back at `srcOffset` into the ranges of the allocation.
+    void recordUpload(VkCommandBuffer cmdbuf, GpuBuffer& src, uint64_t srcOffset, Handle handle);
+
+    void bindVertexBuffer(VkCommandBuffer cmdbuf, uint32_t binding = 0) const;
+    void bindPositionBuffer(VkCommandBuffer cmdbuf, uint32_t binding = 0) const;
+    void bindIndexBuffer(VkCommandBuffer cmdbuf, VkIndexType type = VK_INDEX_TYPE_UINT32) const;
+    void bindEdgeBuffer(VkCommandBuffer cmdbuf, VkIndexType type = VK_INDEX_TYPE_UINT32) const;
+
+    uint32_t getVertexStride()   const { return vertexPool.streams[0].unitSize; }
+    uint32_t getPositionStride() const { return vertexPool.streams[1].unitSize; }
+
+    /// Bytes used in all buffers together.
+    uint64_t getUsedSize() const;
+
+    /// Bytes allocated for all buffers together.
+    uint64_t getCapacitySize() const;
+private:
+    /// One buffer of a pool. Ranges are in the same units for all streams,
+    /// only the amount of bytes per unit differs.
+    struct Stream {
+        std::unique_ptr<GpuBuffer> buffer;
+        uint32_t                   unitSize;
+    };
+
+    struct Pool {
+        std::vector<Stream> streams; // The first one defines the capacity in bytes.
+        RangeAllocator      ranges;
+        VkBufferUsageFlags  usage;
+    };
+
+    void initPool(Pool& pool, std::initializer_list<uint32_t> unitSizes, VkBufferUsageFlags usage, uint64_t capacity);
+    void growPool(Pool& pool, uint32_t minFreeUnits);
+    void compactPool(VkCommandBuffer cmdbuf, Pool& pool, RangeAllocator::Range Allocation::* member,
+                     std::vector<std::unique_ptr<GpuBuffer>>& retired);
+    static uint32_t toUnits(const Pool& pool, uint64_t bytes);
+
+    Renderer& renderer;
+    Pool      vertexPool;
+    Pool      indexPool;
+    Pool      edgePool;
+
+    std::vector<Allocation> allocations;
+    std::vector<bool>       live;
+    std::vector<Handle>     freeHandles;
+};
@@ -0,0 +1,362 @@
+///
+/// Vulkan Shadows
+/// Author: Fedor Vorobev
+///
+/// On-disk cache of the processed mesh geometry.
+///
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <type_traits>
+#include "GeometryCache.hpp"
+#include "WorkerPool.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Everything in the file is copied as is.
+static_assert(std::is_trivially_copyable_v<VIBPrimGroup>);
+static_assert(std::is_trivially_copyable_v<MeshletData>);
+
+static constexpr char     CACHE_MAGIC[8] = { 'V', 'K', 'S', 'G', 'E', 'O', 'M', 0 };
+static constexpr uint64_t CACHE_ALIGNMENT = 16;
+
+struct CacheHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t meshCount;
+    uint64_t key;
+};
+
+// One per mesh, right after the header. Offsets are from the file start.
+struct CacheMeshRecord {
+    uint64_t  dataOffset;
+    uint64_t  groupsOffset;
+    uint64_t  meshletsOffset;
+    uint32_t  groupCount;
+    uint32_t  meshletCount;
+    uint32_t  vertexBytes;
+    uint32_t  positionBytes;
+    uint32_t  indexBytes;
+    uint32_t  edgeBytes;
+    glm::mat4 dequantize;
+};
+
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + CACHE_ALIGNMENT - 1) & ~(CACHE_ALIGNMENT - 1);
+}
+
+MappedFile::MappedFile(const std::string& path)
+    : data(nullptr)
+    , size(0)
+{
+#ifdef _WIN32
+    file    = INVALID_HANDLE_VALUE;
+    mapping = nullptr;
+    HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (f == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    file = f;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(f, &fileSize) || fileSize.QuadPart == 0) {
+        return;
+    }
+    mapping = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        return;
+    }
+    data = reinterpret_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    size = data ? uint64_t(fileSize.QuadPart) : 0;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* mapped = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            data = reinterpret_cast<const uint8_t*>(mapped);
+            size = uint64_t(st.st_size);
+        }
+    }
+    ::close(fd); // The mapping stays valid.
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+    if (data) {
+        UnmapViewOfFile(data);
+    }
+    if (mapping) {
+        CloseHandle(mapping);
+    }
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+    }
+#else
+    if (data) {
+        munmap(const_cast<uint8_t*>(data), size_t(size));
+    }
+#endif
+}
+
+static uint64_t hash_mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDull;
+    x ^= x >> 33;
+    return x;
+}
+
+void ContentHash::add(const void* data, size_t size) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    uint64_t h = state ^ (uint64_t(size) * 0xC2B2AE3D27D4EB4Full);
+    while (size >= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        h = (h ^ hash_mix(word)) * 0x9E3779B97F4A7C15ull;
+        bytes += sizeof(word);
+        size  -= sizeof(word);
+    }
+    if (size > 0) {
+        uint64_t word = 0;
+        memcpy(&word, bytes, size);
+        h = (h ^ hash_mix(word)) * 0x9E3779B97F4A7C15ull;
+    }
+    state = hash_mix(h);
+}
+
+uint64_t GeometryCache::computeKey(const tinygltf::Model& model, const VIBConf& conf) {
+    ContentHash hash(VERSION);
+    hash.add(uint32_t(sizeof(VIBPrimGroup)));
+    hash.add(uint32_t(sizeof(MeshletData)));
+
+    // Options that change the output. The stats flags only print.
+    hash.add(uint32_t(conf.edgeBuilder));
+    hash.add(conf.weld);
+    hash.add(conf.weldTolerance);
+    hash.add(conf.compactEdges);
+    hash.add(conf.pruneEdges);
+    hash.add(conf.pruneAngle);
+    hash.add(uint32_t(conf.vertexFormat));
+    hash.add(conf.optimize);
+
+    // The buffers are the bulk of it, hash them in parallel.
+    std::vector<uint64_t> bufferHashes(model.buffers.size());
+    WorkerPool::get().run(uint32_t(model.buffers.size()), [&](uint32_t b) {
+        ContentHash bufferHash;
+        bufferHash.add(model.buffers[b].data.data(), model.buffers[b].data.size());
+        bufferHashes[b] = bufferHash.get();
+    });
+    hash.add(bufferHashes.data(), bufferHashes.size() * sizeof(uint64_t));
+
+    // And how the meshes read them.
+    for (const auto& view : model.bufferViews) {
+        hash.add(view.buffer);
+        hash.add(view.byteOffset);
+        hash.add(view.byteLength);
+        hash.add(view.byteStride);
+    }
+    for (const auto& accessor : model.accessors) {
+        hash.add(accessor.bufferView);
+        hash.add(accessor.byteOffset);
+        hash.add(accessor.componentType);
+        hash.add(accessor.type);
+        hash.add(accessor.count);
+        hash.add(accessor.normalized);
+        hash.add(accessor.sparse.isSparse);
+        if (accessor.sparse.isSparse) {
+            hash.add(accessor.sparse.count);
+            hash.add(accessor.sparse.indices.bufferView);
+            hash.add(accessor.sparse.indices.byteOffset);
+            hash.add(accessor.sparse.indices.componentType);
+            hash.add(accessor.sparse.values.bufferView);
+            hash.add(accessor.sparse.values.byteOffset);
+        }
+    }
+    for (const auto& mesh : model.meshes) {
+        hash.add(uint32_t(mesh.primitives.size()));
+        for (const auto& primitive : mesh.primitives) {
+            hash.add(primitive.indices);
+            hash.add(primitive.material);
+            hash.add(primitive.mode);
+            for (const char* attribute : { "POSITION", "NORMAL", "TEXCOORD_0" }) {
+                auto it = primitive.attributes.find(attribute);
+                hash.add((it != primitive.attributes.end()) ? it->second : -1);
+            }
+        }
+    }
+    return hash.get();
+}
+
+/// True if all ranges of the group lie within the streams of its mesh,
+/// so that a damaged file can't turn into out of bounds draws.
+static bool is_group_valid(const VIBPrimGroup& group, const GeometryCache::Mesh& mesh, uint32_t vertexStride) {
+    if (group.indexType != VK_INDEX_TYPE_UINT16 && group.indexType != VK_INDEX_TYPE_UINT32) {
+        return false;
+    }
+    const uint64_t indexSize   = index_type_size(group.indexType);
+    const uint64_t vertexCount = mesh.vertexBytes / vertexStride;
+    const uint64_t indexCount  = mesh.indexBytes / indexSize;
+    const uint64_t edgeCount   = mesh.edgeBytes / indexSize;
+    return group.vertexOffset >= 0
+        && uint64_t(group.vertexOffset)       + group.vertexCount        <= vertexCount
+        && uint64_t(group.firstIndex)         + group.indexCount         <= indexCount
+        && uint64_t(group.firstEdgeIndex)     + group.edgeIndexCount     <= edgeCount
+        && uint64_t(group.firstEdgeLineIndex) + group.edgeLineIndexCount <= edgeCount
+        && uint64_t(group.firstMeshlet)       + group.meshletCount       <= mesh.meshletCount;
+}
+
+bool GeometryCache::open(const std::string& path, uint64_t key, uint32_t meshCount, uint32_t vertexStride) {
+    meshes.clear();
+    file = std::make_unique<MappedFile>(path);
+    if (!file->isMapped() || file->getSize() < sizeof(CacheHeader)) {
+        file.reset();
+        return false;
+    }
+
+    const uint8_t* base     = file->getData();
+    const uint64_t fileSize = file->getSize();
+    const auto     inside   = [&](uint64_t offset, uint64_t size) {
+        return offset <= fileSize && size <= fileSize - offset;
+    };
+
+    CacheHeader header;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0
+     || header.version   != VERSION
+     || header.key       != key
+     || header.meshCount != meshCount
+     || !inside(sizeof(CacheHeader), uint64_t(meshCount) * sizeof(CacheMeshRecord)))
+    {
+        file.reset();
+        return false;
+    }
+
+    meshes.resize(meshCount);
+    for (uint32_t m = 0; m < meshCount; ++m) {
+        CacheMeshRecord record;
+        memcpy(&record, base + sizeof(CacheHeader) + m * sizeof(CacheMeshRecord), sizeof(record));
+
+        auto& mesh = meshes[m];
+        mesh.groupCount    = record.groupCount;
+        mesh.meshletCount  = record.meshletCount;
+        mesh.vertexBytes   = record.vertexBytes;
+        mesh.positionBytes = record.positionBytes;
+        mesh.indexBytes    = record.indexBytes;
+        mesh.edgeBytes     = record.edgeBytes;
+        mesh.dequantize    = record.dequantize;
+
+        const bool valid = inside(record.dataOffset,     mesh.getBufferSize())
+                        && inside(record.groupsOffset,   uint64_t(record.groupCount)   * sizeof(VIBPrimGroup))
+                        && inside(record.meshletsOffset, uint64_t(record.meshletCount) * sizeof(MeshletData))
+                        && (record.groupsOffset   % CACHE_ALIGNMENT) == 0
+                        && (record.meshletsOffset % CACHE_ALIGNMENT) == 0;
+        if (!valid) {
+            meshes.clear();
+            file.reset();
+            return false;
+        }
+        mesh.data     = base + record.dataOffset;
+        mesh.groups   = reinterpret_cast<const VIBPrimGroup*>(base + record.groupsOffset);
+        mesh.meshlets = reinterpret_cast<const MeshletData*>(base + record.meshletsOffset);
+
+        for (uint32_t g = 0; g < mesh.groupCount; ++g) {
+            if (!is_group_valid(mesh.groups[g], mesh, vertexStride)) {
+                meshes.clear();
+                file.reset();
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool GeometryCache::write(const std::string& path, uint64_t key,
+                          const std::vector<std::unique_ptr<VIBufferBuilder>>& builders)
+{
+    // Lay everything out first, the records come before the data.
+    const uint32_t meshCount = uint32_t(builders.size());
+    std::vector<CacheMeshRecord> records(meshCount);
+    uint64_t offset = sizeof(CacheHeader) + uint64_t(meshCount) * sizeof(CacheMeshRecord);
+    for (uint32_t m = 0; m < meshCount; ++m) {
+        const auto& builder = *builders[m];
+        auto& record = records[m];
+        record.groupCount    = uint32_t(builder.groups.size());
+        record.meshletCount  = uint32_t(builder.meshlets.size());
+        record.vertexBytes   = builder.getVertexDataSize();
+        record.positionBytes = builder.getPositionDataSize();
+        record.indexBytes    = builder.getIndexDataSize();
+        record.edgeBytes     = builder.getEdgeDataSize();
+        record.dequantize    = builder.getDequantizeTransform();
+
+        record.groupsOffset   = align_offset(offset);
+        offset = record.groupsOffset + record.groupCount * sizeof(VIBPrimGroup);
+        record.meshletsOffset = align_offset(offset);
+        offset = record.meshletsOffset + record.meshletCount * sizeof(MeshletData);
+        record.dataOffset     = align_offset(offset);
+        offset = record.dataOffset + builder.getBufferSize();
+    }
+
+    // Write to a temporary file and swap it in at the end, so that an
+    // interrupted write never leaves a broken cache behind.
+    const std::string tempPath = path + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            return false;
+        }
+
+        CacheHeader header = {};
+        memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        header.version   = VERSION;
+        header.meshCount = meshCount;
+        header.key       = key;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(CacheMeshRecord));
+
+        uint64_t written = sizeof(CacheHeader) + uint64_t(meshCount) * sizeof(CacheMeshRecord);
+        const auto pad = [&](uint64_t to) {
+            static constexpr char zeros[CACHE_ALIGNMENT] = {};
+            out.write(zeros, std::streamsize(to - written));
+            written = to;
+        };
+
+        std::vector<uint8_t> data;
+        for (uint32_t m = 0; m < meshCount; ++m) {
+            const auto& builder = *builders[m];
+            const auto& record  = records[m];
+
+            pad(record.groupsOffset);
+            out.write(reinterpret_cast<const char*>(builder.groups.data()), record.groupCount * sizeof(VIBPrimGroup));
+            written += record.groupCount * sizeof(VIBPrimGroup);
+
+            pad(record.meshletsOffset);
+            out.write(reinterpret_cast<const char*>(builder.meshlets.data()), record.meshletCount * sizeof(MeshletData));
+            written += record.meshletCount * sizeof(MeshletData);
+
+            pad(record.dataOffset);
+            data.resize(builder.getBufferSize());
+            builder.writeBufferData(data.data());
+            out.write(reinterpret_cast<const char*>(data.data()), data.size());
+            written += data.size();
+        }
+        if (!out.good()) {
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, path, error);
+    return !error;
+}
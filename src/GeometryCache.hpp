@@ -0,0 +1,101 @@
+///
+/// Vulkan Shadows
+/// Author: Fedor Vorobev
+///
+/// On-disk cache of the processed mesh geometry.
+///
+/// Building edge adjacency and the rest of VIBufferBuilder's work only
+/// depends on the glTF buffers and the import options. The cache file
+/// stores its final output for every mesh: the primitive groups, the
+/// meshlets and the vertex/position/index/edge data exactly as
+/// writeBufferData() lays it out. Later runs map the file and copy the
+/// data straight into staging memory.
+///
+/// The file is keyed by a hash of everything the output depends on, a
+/// mismatching key simply counts as a miss and the file is rewritten.
+///
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "glm.hpp"
+#include "VIBufferBuilder.hpp"
+
+/// Read-only memory mapping of a whole file.
+class MappedFile {
+public:
+    /// Returns an unmapped object if the file can't be opened.
+    MappedFile(const std::string& path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+
+    bool           isMapped() const { return data != nullptr; }
+    const uint8_t* getData()  const { return data; }
+    uint64_t       getSize()  const { return size; }
+private:
+    const uint8_t* data;
+    uint64_t       size;
+#ifdef _WIN32
+    void*          file;
+    void*          mapping;
+#endif
+};
+
+/// 64-bit hash for cache keys. Not cryptographic, just fast.
+class ContentHash {
+public:
+    ContentHash(uint64_t seed = 0) : state(seed ^ 0x9E3779B97F4A7C15ull) {}
+
+    void add(const void* data, size_t size);
+
+    template<typename T>
+    void add(const T& value) { add(&value, sizeof(T)); }
+
+    uint64_t get() const { return state; }
+private:
+    uint64_t state;
+};
+
+class GeometryCache {
+public:
+    static constexpr uint32_t VERSION = 2; // Bump whenever the builder output changes.
+
+    struct Mesh {
+        const uint8_t*      data; // getBufferSize() bytes, laid out like VIBufferBuilder::writeBufferData().
+        const VIBPrimGroup* groups;
+        const MeshletData*  meshlets;
+        uint32_t            groupCount;
+        uint32_t            meshletCount;
+        uint32_t            vertexBytes;
+        uint32_t            positionBytes;
+        uint32_t            indexBytes;
+        uint32_t            edgeBytes;
+        glm::mat4           dequantize;
+
+        uint64_t getBufferSize() const { return uint64_t(vertexBytes) + positionBytes + indexBytes + edgeBytes; }
+    };
+
+    /// Computes the key for the meshes of a model built with `conf`.
+    static uint64_t computeKey(const tinygltf::Model& model, const VIBConf& conf);
+
+    /// Maps the cache file. Returns false if it's missing, from a different
+    /// version, doesn't match the key and the mesh count, or has a group
+    /// reaching past its mesh's data. `vertexStride` is the size of the
+    /// interleaved vertices the key was computed for. Nothing stays
+    /// mapped then, so write() can replace the file (Windows refuses to
+    /// rename over a mapped file).
+    bool open(const std::string& path, uint64_t key, uint32_t meshCount, uint32_t vertexStride);
+
+    /// Valid after open() returned true, until the cache is destroyed.
+    const Mesh& getMesh(uint32_t index) const { return meshes[index]; }
+
+    /// Writes the output of the builders, one per mesh, to a new cache
+    /// file. Returns false on I/O errors, the cache is optional after all.
+    static bool write(const std::string& path, uint64_t key,
+                      const std::vector<std::unique_ptr<VIBufferBuilder>>& builders);
+private:
+    std::unique_ptr<MappedFile> file;
+    std::vector<Mesh>           meshes;
+};
@@ -22,10 +22,14 @@ public:
     static constexpr VkBufferUsageFlags USAGE_STORAGE = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
                                                       | VK_BUFFER_USAGE_TRANSFER_DST_BIT
                                                       | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    static constexpr VkBufferUsageFlags USAGE_INDIRECT = USAGE_STORAGE
+                                                       | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
 
     static constexpr VmaAllocationCreateFlags STAGING_FLAGS = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT
                                                             | VMA_ALLOCATION_CREATE_MAPPED_BIT;
-    static constexpr VmaAllocationCreateFlags GPUMEM_FLAGS = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+    // Let VMA pick between dedicated and pooled memory, mesh data is packed
+    // into a few large buffers by GeometryArena anyway.
+    static constexpr VmaAllocationCreateFlags GPUMEM_FLAGS = 0;
 
     GpuBuffer(Renderer& renderer,
               uint64_t size,
@@ -56,8 +60,8 @@ protected:
 /// For passing data to shaders using buffer device address feature.
 class GpuShaderBuffer : public GpuBuffer {
 public:
-    GpuShaderBuffer(Renderer& renderer, uint64_t size)
-        : GpuBuffer(renderer, size, GpuBuffer::USAGE_STORAGE, GpuBuffer::GPUMEM_FLAGS)
+    GpuShaderBuffer(Renderer& renderer, uint64_t size, VkBufferUsageFlags usage = GpuBuffer::USAGE_STORAGE)
+        : GpuBuffer(renderer, size, usage, GpuBuffer::GPUMEM_FLAGS)
     {
         VkBufferDeviceAddressInfo bdai = { VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO };
         bdai.buffer = buffer;
@@ -0,0 +1,220 @@
+///
+/// Vulkan Shadows
+/// Author: Fedor Vorobev
+///
+/// Triangle and vertex reordering for better GPU cache use.
+///
+#include <algorithm>
+#include <numeric>
+#include "MeshOptimizer.hpp"
+
+void MeshOptimizer::optimizeTriangleOrder(uint32_t* indices, uint32_t indexCount, const VertexNT* vertices, uint32_t vertexCount) {
+    const uint32_t triangleCount = indexCount / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    // Build vertex -> triangle adjacency.
+    triangleOffsets.assign(vertexCount + 1, 0);
+    for (uint32_t i = 0; i < triangleCount * 3; ++i) {
+        triangleOffsets[indices[i] + 1]++;
+    }
+    std::partial_sum(triangleOffsets.begin(), triangleOffsets.end(), triangleOffsets.begin());
+    liveTriangles.resize(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+        liveTriangles[v] = triangleOffsets[v + 1] - triangleOffsets[v];
+    }
+    vertexTriangles.resize(triangleCount * 3);
+    std::vector<uint32_t>& fill = cacheTime; // Borrowed until the main loop.
+    fill.assign(triangleOffsets.begin(), triangleOffsets.end() - 1);
+    for (uint32_t i = 0; i < triangleCount * 3; ++i) {
+        vertexTriangles[fill[indices[i]]++] = i / 3;
+    }
+
+    cacheTime.assign(vertexCount, 0);
+    emitted.assign(triangleCount, false);
+    deadEnds.clear();
+    output.clear();
+
+    // Each dead-end jump starts a new cluster. The cache is effectively
+    // flushed there, so clusters can later be moved around cheaply.
+    std::vector<uint32_t> clusterStarts;
+    uint32_t time   = CACHE_SIZE + 1;
+    uint32_t cursor = 0;
+    uint32_t fan    = 0;
+    clusterStarts.push_back(0);
+    while (fan != NONE) {
+        candidates.clear();
+        for (uint32_t k = triangleOffsets[fan]; k < triangleOffsets[fan + 1]; ++k) {
+            uint32_t t = vertexTriangles[k];
+            if (emitted[t]) {
+                continue;
+            }
+            emitted[t] = true;
+            for (uint32_t c = 0; c < 3; ++c) {
+                uint32_t v = indices[t * 3 + c];
+                output.push_back(v);
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                liveTriangles[v]--;
+                if (time - cacheTime[v] > CACHE_SIZE) {
+                    cacheTime[v] = time++;
+                }
+            }
+        }
+
+        // Prefer the candidate that is still in the cache and stays there
+        // long enough to get all of its remaining triangles emitted. Any
+        // live candidate beats a dead-end jump, even one with priority 0.
+        uint32_t best     = NONE;
+        int64_t  bestTime = -1;
+        for (uint32_t v : candidates) {
+            if (liveTriangles[v] == 0) {
+                continue;
+            }
+            int64_t priority = 0;
+            if (time - cacheTime[v] + 2 * liveTriangles[v] <= CACHE_SIZE) {
+                priority = time - cacheTime[v];
+            }
+            if (priority > bestTime) {
+                best     = v;
+                bestTime = priority;
+            }
+        }
+        if (best == NONE) {
+            best = nextVertex(cursor, vertexCount);
+            if (best != NONE && clusterStarts.back() != output.size() / 3) {
+                clusterStarts.push_back(uint32_t(output.size() / 3));
+            }
+        }
+        fan = best;
+    }
+    std::copy(output.begin(), output.end(), indices);
+
+    sortClusters(indices, vertices, clusterStarts);
+}
+
+uint32_t MeshOptimizer::nextVertex(uint32_t& cursor, uint32_t vertexCount) {
+    // Recently emitted vertices first, they may still be in the cache.
+    while (!deadEnds.empty()) {
+        uint32_t v = deadEnds.back();
+        deadEnds.pop_back();
+        if (liveTriangles[v] > 0) {
+            return v;
+        }
+    }
+    while (cursor < vertexCount) {
+        if (liveTriangles[cursor] > 0) {
+            return cursor;
+        }
+        ++cursor;
+    }
+    return NONE;
+}
+
+void MeshOptimizer::sortClusters(uint32_t* indices, const VertexNT* vertices, const std::vector<uint32_t>& clusterStarts) {
+    const uint32_t triangleCount = uint32_t(output.size() / 3);
+    const uint32_t clusterCount  = uint32_t(clusterStarts.size());
+    if (clusterCount < 2) {
+        return;
+    }
+
+    struct Cluster {
+        uint32_t  first;
+        uint32_t  count;
+        glm::vec3 centroid;
+        glm::vec3 normal; // Area weighted
+        float     key;
+    };
+    std::vector<Cluster> clusters(clusterCount);
+    glm::vec3 meshCentroid(0.0f);
+    float     meshArea = 0.0f;
+    for (uint32_t c = 0; c < clusterCount; ++c) {
+        auto& cluster = clusters[c];
+        cluster.first    = clusterStarts[c];
+        cluster.count    = ((c + 1 < clusterCount) ? clusterStarts[c + 1] : triangleCount) - cluster.first;
+        cluster.centroid = glm::vec3(0.0f);
+        cluster.normal   = glm::vec3(0.0f);
+
+        float area = 0.0f;
+        for (uint32_t t = cluster.first; t < cluster.first + cluster.count; ++t) {
+            const glm::vec3& a = vertices[indices[t * 3 + 0]].position;
+            const glm::vec3& b = vertices[indices[t * 3 + 1]].position;
+            const glm::vec3& c = vertices[indices[t * 3 + 2]].position;
+            glm::vec3 n = glm::cross(b - a, c - a);
+            float     w = glm::length(n);
+            cluster.normal   += n;
+            cluster.centroid += (a + b + c) * (w / 3.0f);
+            area += w;
+        }
+        if (area > 0.0f) {
+            cluster.centroid /= area;
+        }
+        meshCentroid += cluster.centroid * area;
+        meshArea     += area;
+    }
+    if (meshArea > 0.0f) {
+        meshCentroid /= meshArea;
+    }
+
+    // Clusters facing away from the center are likely to occlude the
+    // others, so they go first.
+    for (auto& cluster : clusters) {
+        float length = glm::length(cluster.normal);
+        cluster.key = (length > 0.0f) ? glm::dot(cluster.centroid - meshCentroid, cluster.normal / length) : 0.0f;
+    }
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) {
+        return a.key > b.key;
+    });
+
+    uint32_t written = 0;
+    for (const auto& cluster : clusters) {
+        std::copy(output.begin() + cluster.first * 3,
+                  output.begin() + (cluster.first + cluster.count) * 3,
+                  indices + written);
+        written += cluster.count * 3;
+    }
+}
+
+void MeshOptimizer::optimizeVertexOrder(uint32_t* indices, uint32_t indexCount, VertexNT* vertices, uint32_t vertexCount) {
+    std::vector<uint32_t>& remap = cacheTime; // Scratch, not needed past the triangle order.
+    remap.assign(vertexCount, NONE);
+
+    uint32_t next = 0;
+    for (uint32_t i = 0; i < indexCount; ++i) {
+        uint32_t& r = remap[indices[i]];
+        if (r == NONE) {
+            r = next++;
+        }
+        indices[i] = r;
+    }
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+        if (remap[v] == NONE) {
+            remap[v] = next++;
+        }
+    }
+
+    vertexScratch.assign(vertices, vertices + vertexCount);
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+        vertices[remap[v]] = vertexScratch[v];
+    }
+}
+
+MeshOptimizer::CacheStats MeshOptimizer::analyze(const uint32_t* indices, uint32_t indexCount, uint32_t vertexCount) {
+    // A vertex is in the FIFO cache if it was inserted less than
+    // CACHE_SIZE insertions ago.
+    std::vector<uint32_t>& inserted = cacheTime;
+    inserted.assign(vertexCount, NONE);
+
+    CacheStats stats = { 0, indexCount / 3, 0 };
+    for (uint32_t i = 0; i < stats.triangles * 3; ++i) {
+        uint32_t v = indices[i];
+        if (inserted[v] == NONE) {
+            stats.vertices++;
+        }
+        if (inserted[v] == NONE || stats.transformed - inserted[v] >= CACHE_SIZE) {
+            inserted[v] = stats.transformed++;
+        }
+    }
+    return stats;
+}
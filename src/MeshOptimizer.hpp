@@ -0,0 +1,59 @@
+///
+/// Vulkan Shadows
+/// Author: Fedor Vorobev
+///
+/// Triangle and vertex reordering for better GPU cache use.
+///
+/// Triangles are first reordered for the post-transform vertex cache using
+/// Tipsify (Sander, Nehab, Barczak - "Fast Triangle Reordering for Vertex
+/// Locality and Reduced Overdraw"). The clusters Tipsify produces between
+/// its dead-end jumps are then sorted so that outward facing ones come
+/// first, which reduces overdraw without touching the cache order within
+/// a cluster. Finally, vertices are renumbered in the order of their first
+/// use for better vertex fetch locality.
+///
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Vertex.hpp"
+
+class MeshOptimizer {
+public:
+    /// Cache size the triangle order is optimized and measured for.
+    static constexpr uint32_t CACHE_SIZE = 16;
+
+    struct CacheStats {
+        uint32_t transformed; // Vertex shader invocations with a FIFO cache of CACHE_SIZE.
+        uint32_t triangles;
+        uint32_t vertices;    // Unique vertices referenced.
+    };
+
+    /// Reorders the triangles of a list in place. Indices must be below
+    /// `vertexCount`.
+    void optimizeTriangleOrder(uint32_t* indices, uint32_t indexCount, const VertexNT* vertices, uint32_t vertexCount);
+
+    /// Renumbers vertices in the order in which the indices first use
+    /// them, unused ones go last. Both arrays are rewritten in place.
+    void optimizeVertexOrder(uint32_t* indices, uint32_t indexCount, VertexNT* vertices, uint32_t vertexCount);
+
+    /// Simulates a FIFO post-transform cache. ACMR is transformed/triangles,
+    /// ATVR is transformed/vertices.
+    CacheStats analyze(const uint32_t* indices, uint32_t indexCount, uint32_t vertexCount);
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    uint32_t nextVertex(uint32_t& cursor, uint32_t vertexCount);
+    void     sortClusters(uint32_t* indices, const VertexNT* vertices, const std::vector<uint32_t>& clusterStarts);
+
+    // Triangles using each vertex, CSR layout.
+    std::vector<uint32_t> triangleOffsets;
+    std::vector<uint32_t> vertexTriangles;
+    std::vector<uint32_t> liveTriangles; // Not yet emitted triangles per vertex.
+    std::vector<uint32_t> cacheTime;     // When each vertex entered the cache.
+    std::vector<uint32_t> deadEnds;
+    std::vector<uint32_t> candidates;
+    std::vector<bool>     emitted;
+    std::vector<uint32_t> output;
+    std::vector<VertexNT> vertexScratch;
+};
@@ -0,0 +1,121 @@
+///
+/// Vulkan Shadows
+/// Author: Fedor Vorobev
+///
+/// Splitting of primitive groups into meshlets for cluster culling.
+///
+#include <algorithm>
+#include <cmath>
+#include "MeshletBuilder.hpp"
+
+uint32_t MeshletBuilder::build(const uint32_t* indices, uint32_t indexCount,
+                               const VertexNT* vertices, uint32_t vertexCount,
+                               std::vector<MeshletData>& out)
+{
+    const uint32_t triangleCount = indexCount / 3;
+    const size_t   firstMeshlet  = out.size();
+    stamps.assign(vertexCount, UINT32_MAX);
+
+    MeshletData current = {};
+    uint32_t    stamp   = 0;
+    for (uint32_t t = 0; t < triangleCount; ++t) {
+        const uint32_t* tri = indices + t * 3;
+        uint32_t newVertices = 0;
+        for (uint32_t c = 0; c < 3; ++c) {
+            // Count repeated indices of degenerate triangles once.
+            bool repeated = (c > 0 && tri[c] == tri[0]) || (c > 1 && tri[c] == tri[1]);
+            newVertices += (stamps[tri[c]] != stamp && !repeated);
+        }
+
+        if (current.triangleCount == MAX_TRIANGLES || current.vertexCount + newVertices > MAX_VERTICES) {
+            calcBounds(indices, vertices, current);
+            out.push_back(current);
+            current = {};
+            current.firstTriangle = t;
+            stamp++;
+            newVertices = 0;
+            for (uint32_t c = 0; c < 3; ++c) {
+                bool repeated = (c > 0 && tri[c] == tri[0]) || (c > 1 && tri[c] == tri[1]);
+                newVertices += !repeated;
+            }
+        }
+
+        for (uint32_t c = 0; c < 3; ++c) {
+            stamps[tri[c]] = stamp;
+        }
+        current.vertexCount += newVertices;
+        current.triangleCount++;
+    }
+    if (current.triangleCount > 0) {
+        calcBounds(indices, vertices, current);
+        out.push_back(current);
+    }
+    return uint32_t(out.size() - firstMeshlet);
+}
+
+void MeshletBuilder::calcBounds(const uint32_t* indices, const VertexNT* vertices, MeshletData& meshlet) {
+    const uint32_t* first = indices + meshlet.firstTriangle * 3;
+    const uint32_t  count = meshlet.triangleCount * 3;
+
+    // Sphere around the AABB center, good enough for culling.
+    glm::vec3 lo = vertices[first[0]].position;
+    glm::vec3 hi = lo;
+    for (uint32_t i = 0; i < count; ++i) {
+        lo = glm::min(lo, vertices[first[i]].position);
+        hi = glm::max(hi, vertices[first[i]].position);
+    }
+    meshlet.center = (lo + hi) * 0.5f;
+    meshlet.radius = 0.0f;
+    for (uint32_t i = 0; i < count; ++i) {
+        meshlet.radius = std::max(meshlet.radius, glm::length(vertices[first[i]].position - meshlet.center));
+    }
+
+    // Normal cone, following meshoptimizer's meshopt_computeClusterBounds.
+    normals.clear();
+    glm::vec3 axis(0.0f);
+    for (uint32_t t = 0; t < meshlet.triangleCount; ++t) {
+        const glm::vec3& a = vertices[first[t * 3 + 0]].position;
+        const glm::vec3& b = vertices[first[t * 3 + 1]].position;
+        const glm::vec3& c = vertices[first[t * 3 + 2]].position;
+        glm::vec3 n = glm::cross(b - a, c - a);
+        float     l = glm::length(n);
+        normals.push_back(l > 0.0f ? n / l : glm::vec3(0.0f)); // Degenerate ones don't count.
+        axis += normals.back();
+    }
+
+    meshlet.coneApex   = meshlet.center;
+    meshlet.coneAxis   = glm::vec3(0.0f, 0.0f, 1.0f);
+    meshlet.coneCutoff = MeshletBuilder::NO_CONE;
+
+    float axisLength = glm::length(axis);
+    if (axisLength == 0.0f) {
+        return;
+    }
+    axis /= axisLength;
+
+    float minDot = 1.0f;
+    for (const auto& n : normals) {
+        if (n != glm::vec3(0.0f)) {
+            minDot = std::min(minDot, glm::dot(n, axis));
+        }
+    }
+    if (minDot <= 0.1f) {
+        return; // Wider than ~84 degrees, wouldn't cull anything anyway.
+    }
+
+    // Move the apex back far enough for every triangle plane to be in
+    // front of it.
+    float maxT = 0.0f;
+    for (uint32_t t = 0; t < meshlet.triangleCount; ++t) {
+        const auto& n = normals[t];
+        if (n == glm::vec3(0.0f)) {
+            continue;
+        }
+        const glm::vec3& a = vertices[first[t * 3]].position;
+        maxT = std::max(maxT, glm::dot(meshlet.center - a, n) / glm::dot(axis, n));
+    }
+
+    meshlet.coneApex   = meshlet.center - axis * maxT;
+    meshlet.coneAxis   = axis;
+    meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+}
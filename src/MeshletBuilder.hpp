@@ -0,0 +1,56 @@
+///
+/// Vulkan Shadows
+/// Author: Fedor Vorobev
+///
+/// Splitting of primitive groups into meshlets for cluster culling.
+///
+/// A meshlet is a run of consecutive triangles of a primitive group that
+/// touches at most MAX_VERTICES vertices. Since the triangles stay where
+/// they are in the index buffer, a meshlet can be drawn with a plain
+/// vkCmdDrawIndexed of its range, no mesh shaders needed. Running
+/// MeshOptimizer first makes the runs a lot more compact.
+///
+/// Bounds are in mesh space, i.e. before the node transform and without
+/// the dequantization of quantized positions.
+///
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "glm.hpp"
+#include "Vertex.hpp"
+
+/// GPU layout of a meshlet, mirrored in scene.glsl.
+struct alignas(16) MeshletData {
+    glm::vec3 center;        // Bounding sphere
+    float     radius;
+    glm::vec3 coneApex;      // Backfacing from `eye` if dot(normalize(coneApex - eye), coneAxis) >= coneCutoff.
+    float     coneCutoff;
+    glm::vec3 coneAxis;
+    uint32_t  firstTriangle; // Relative to the start of the primitive group.
+    uint32_t  triangleCount;
+    uint32_t  vertexCount;
+    uint32_t  padding0;
+    uint32_t  padding1;
+};
+
+class MeshletBuilder {
+public:
+    static constexpr uint32_t MAX_VERTICES  = 64;
+    static constexpr uint32_t MAX_TRIANGLES = 124;
+
+    /// Cone cutoff for meshlets whose triangles face too many ways.
+    static constexpr float NO_CONE = 2.0f;
+
+    /// Splits the triangles of one group in order and appends the meshlets
+    /// to `out`. Indices must be below `vertexCount`. Returns how many
+    /// meshlets were added.
+    uint32_t build(const uint32_t* indices, uint32_t indexCount,
+                   const VertexNT* vertices, uint32_t vertexCount,
+                   std::vector<MeshletData>& out);
+private:
+    void calcBounds(const uint32_t* indices, const VertexNT* vertices, MeshletData& meshlet);
+
+    std::vector<uint32_t>  stamps;  // Last meshlet that used each vertex.
+    std::vector<glm::vec3> normals; // Per triangle of the current meshlet.
+};
@@ -202,33 +202,66 @@ void PipelineBuilder::addVertexAttribute(uint32_t location, uint32_t binding, Vk
     att.offset   = offset;
 }
 
-void PipelineBuilder::addVertexAttributesFromFlags(uint32_t binding, eVertexFlags flags, eVertexFlags ignore) {
+struct VertexAttributeLayout {
+    eVertexFlags attribute; // eVertexFlags_None for the position
+    VkFormat     format;
+    uint32_t     offset;
+};
+
+/// Lists the attributes of the vertex structure described by `flags`
+/// in order. Returns how many there are.
+static uint32_t get_vertex_layout(eVertexFlags flags, VertexAttributeLayout out[4]) {
+    const bool packed = (flags & eVertexFlags_Packed) != 0;
     uint32_t offset = 0;
-    uint32_t location = 0;
+    uint32_t count  = 0;
 
-    addVertexAttribute(location++, binding, VK_FORMAT_R32G32B32_SFLOAT, offset);
-    offset += sizeof(VertexNTC::position);
+    if (flags & eVertexFlags_QuantizedPosition) {
+        out[count++] = { eVertexFlags_None, VK_FORMAT_R16G16B16A16_UNORM, offset };
+    } else {
+        out[count++] = { eVertexFlags_None, VK_FORMAT_R32G32B32_SFLOAT, offset };
+    }
+    offset += position_size(flags);
 
     if (flags & eVertexFlags_Normal) {
-        if ((ignore & eVertexFlags_Normal) == 0) {
-            addVertexAttribute(location++, binding, VK_FORMAT_R32G32B32_SFLOAT, offset);
-        }
-        offset += sizeof(VertexNTC::normal);
+        out[count++] = { eVertexFlags_Normal, packed ? VK_FORMAT_R16G16_SNORM : VK_FORMAT_R32G32B32_SFLOAT, offset };
+        offset += packed ? 2 * sizeof(int16_t) : sizeof(VertexNTC::normal);
     }
 
     if (flags & eVertexFlags_TexCoord) {
-        if ((ignore & eVertexFlags_TexCoord) == 0) {
-            addVertexAttribute(location++, binding, VK_FORMAT_R32G32_SFLOAT, offset);
-        }
-        offset += sizeof(VertexNTC::texCoord);
+        out[count++] = { eVertexFlags_TexCoord, packed ? VK_FORMAT_R16G16_SFLOAT : VK_FORMAT_R32G32_SFLOAT, offset };
+        offset += packed ? 2 * sizeof(uint16_t) : sizeof(VertexNTC::texCoord);
     }
 
     if (flags & eVertexFlags_Color) {
-        if ((ignore & eVertexFlags_Color) == 0) {
-            addVertexAttribute(location++, binding, VK_FORMAT_R32G32B32A32_SFLOAT, offset);
+        out[count++] = { eVertexFlags_Color, packed ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_R32G32B32A32_SFLOAT, offset };
+        offset += packed ? 4 * sizeof(uint8_t) : sizeof(VertexNTC::color);
+    }
+    return count;
+}
+
+void PipelineBuilder::addVertexAttributesFromFlags(uint32_t binding, eVertexFlags flags, eVertexFlags ignore) {
+    VertexAttributeLayout layout[4];
+    uint32_t count = get_vertex_layout(flags, layout);
+
+    uint32_t location = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        if ((ignore & layout[i].attribute) == 0) {
+            addVertexAttribute(location++, binding, layout[i].format, layout[i].offset);
+        }
+    }
+}
+
+void PipelineBuilder::addVertexAttributeFromFlags(uint32_t location, uint32_t binding, eVertexFlags flags, eVertexFlags attribute) {
+    VertexAttributeLayout layout[4];
+    uint32_t count = get_vertex_layout(flags, layout);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        if (layout[i].attribute == attribute) {
+            addVertexAttribute(location, binding, layout[i].format, layout[i].offset);
+            return;
         }
-        offset += sizeof(VertexNTC::color);
     }
+    throw std::runtime_error("Vertex attribute is not part of the vertex structure.");
 }
 
 void PipelineBuilder::clearBlendAttachments() {
@@ -58,6 +58,10 @@ public:
     void addVertexBinding(uint32_t binding, uint32_t stride, bool instance = false);
     void addVertexAttribute(uint32_t location, uint32_t binding, VkFormat format, uint32_t offset);
     void addVertexAttributesFromFlags(uint32_t binding, eVertexFlags flags, eVertexFlags ignore = eVertexFlags_None);
+    /// Adds just one of the attributes (Normal, TexCoord or Color) of the
+    /// vertex structure described by `flags`, e.g. when the position
+    /// comes from a different binding.
+    void addVertexAttributeFromFlags(uint32_t location, uint32_t binding, eVertexFlags flags, eVertexFlags attribute);
 
     // NOTE:
     // Color formula is as follows:
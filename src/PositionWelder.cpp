@@ -0,0 +1,84 @@
+///
+/// Vulkan Shadows
+/// Author: Fedor Vorobev
+///
+/// Welding of vertices that share a position.
+///
+#include <bit>
+#include <cstring>
+#include "PositionWelder.hpp"
+
+static uint32_t hash_cell(int32_t x, int32_t y, int32_t z) {
+    // Spatial hash from Teschner et al., "Optimized Spatial Hashing
+    // for Collision Detection of Deformable Objects".
+    return (uint32_t(x) * 73856093u) ^ (uint32_t(y) * 19349663u) ^ (uint32_t(z) * 83492791u);
+}
+
+static glm::ivec3 exact_cell(const glm::vec3& p) {
+    // Adding zero turns -0.0 into +0.0 so both end up in the same cell.
+    glm::vec3  q = p + glm::vec3(0.0f);
+    glm::ivec3 bits;
+    std::memcpy(&bits, &q, sizeof(bits));
+    return bits;
+}
+
+uint32_t PositionWelder::weld(const VertexNT* vertices, uint32_t vertexCount, float tolerance, std::vector<uint32_t>& remap) {
+    remap.resize(vertexCount);
+    if (vertexCount == 0) {
+        return 0;
+    }
+
+    const uint32_t tableSize = std::bit_ceil(vertexCount * 2);
+    const uint32_t tableMask = tableSize - 1;
+    heads.assign(tableSize, NONE);
+    next.assign(vertexCount, NONE);
+
+    const bool  exact     = tolerance <= 0.0f;
+    const float cellScale = exact ? 0.0f : 1.0f / tolerance;
+    const float tolerance2 = tolerance * tolerance;
+
+    uint32_t uniqueCount = 0;
+    for (uint32_t v = 0; v < vertexCount; ++v) {
+        const glm::vec3& p = vertices[v].position;
+
+        uint32_t found = NONE;
+        glm::ivec3 cell;
+        if (exact) {
+            // Cells are the bit patterns of the positions themselves.
+            cell = exact_cell(p);
+            for (uint32_t c = heads[hash_cell(cell.x, cell.y, cell.z) & tableMask]; c != NONE; c = next[c]) {
+                if (vertices[c].position == p) {
+                    found = c;
+                    break;
+                }
+            }
+        } else {
+            // Cells are as large as the tolerance, so any match is in
+            // one of the 27 cells around the vertex.
+            cell = glm::ivec3(glm::floor(p * cellScale));
+            for (int32_t dz = -1; dz <= 1 && found == NONE; ++dz)
+            for (int32_t dy = -1; dy <= 1 && found == NONE; ++dy)
+            for (int32_t dx = -1; dx <= 1 && found == NONE; ++dx) {
+                uint32_t slot = hash_cell(cell.x + dx, cell.y + dy, cell.z + dz) & tableMask;
+                for (uint32_t c = heads[slot]; c != NONE; c = next[c]) {
+                    glm::vec3 d = vertices[c].position - p;
+                    if (glm::dot(d, d) <= tolerance2) {
+                        found = c;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (found != NONE) {
+            remap[v] = found;
+        } else {
+            uint32_t slot = hash_cell(cell.x, cell.y, cell.z) & tableMask;
+            remap[v]    = v;
+            next[v]     = heads[slot];
+            heads[slot] = v;
+            uniqueCount++;
+        }
+    }
+    return uniqueCount;
+}
@@ -0,0 +1,34 @@
+///
+/// Vulkan Shadows
+/// Author: Fedor Vorobev
+///
+/// Welding of vertices that share a position.
+///
+/// glTF exporters split vertices along normal and UV seams, so a closed
+/// surface comes in as several patches that merely touch each other. For
+/// edge adjacency, these seams look like open borders. The welder maps each
+/// vertex to a representative vertex with the same position, so adjacency
+/// can be computed on positions alone while the draw indices keep their
+/// original attributes.
+///
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Vertex.hpp"
+
+class PositionWelder {
+public:
+    /// Fills `remap` with the representative vertex of each vertex. The
+    /// representative is the first vertex within `tolerance` of it
+    /// (exact match when `tolerance` is 0). Returns the amount of
+    /// unique positions.
+    uint32_t weld(const VertexNT* vertices, uint32_t vertexCount, float tolerance, std::vector<uint32_t>& remap);
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    // Separate chaining over a power of two table. Only representatives
+    // are ever inserted.
+    std::vector<uint32_t> heads;
+    std::vector<uint32_t> next;
+};
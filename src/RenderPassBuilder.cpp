@@ -9,6 +9,13 @@
 #include "RenderPassBuilder.hpp"
 
 VkRenderPass RenderPassBuilder::create(Renderer& renderer) {
+    // View masks have to be given for every subpass or none.
+    multiview.subpassCount = ci.subpassCount;
+    for (uint32_t i = 0; i < ci.subpassCount; ++i) {
+        if (viewMasks[i] != 0) {
+            ci.pNext = &multiview;
+        }
+    }
     VkRenderPass renderPass;
     VKCHECK(vkCreateRenderPass(renderer.getDevice(), &ci, nullptr, &renderPass));
     return renderPass;
@@ -19,12 +26,15 @@ void RenderPassBuilder::reset() {
     ci.pAttachments  = attachments;
     ci.pSubpasses    = subpasses;
     ci.pDependencies = dependencies;
+    multiview = { VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO };
+    multiview.pViewMasks = viewMasks;
 
     memset(subpasses, 0, sizeof(subpasses));
     memset(attachments, 0, sizeof(attachments));
     memset(depthRefs, 0, sizeof(depthRefs));
     memset(colorRefs, 0, sizeof(colorRefs));
     memset(dependencies, 0, sizeof(dependencies));
+    memset(viewMasks, 0, sizeof(viewMasks));
 }
 
 uint32_t RenderPassBuilder::addAttachment(VkFormat format,
@@ -106,4 +116,11 @@ void RenderPassBuilder::addDependency(const VkSubpassDependency& d) {
         throw std::runtime_error("Too many dependencies.");
     }
     dependencies[ci.dependencyCount++] = d;
+}
+
+void RenderPassBuilder::setSubpassViewMask(uint32_t subpass, uint32_t viewMask) {
+    if (subpass >= ci.subpassCount) {
+        throw std::runtime_error("Tried setting a view mask of a non-existing subpass.");
+    }
+    viewMasks[subpass] = viewMask;
 }
\ No newline at end of file
@@ -31,8 +31,13 @@ public:
     void addSubpassColorAttachment(uint32_t subpass, uint32_t att, VkImageLayout layout);
     void setSubpassDepthStencilAttachment(uint32_t subpass, uint32_t att, VkImageLayout layout);
     void addDependency(const VkSubpassDependency& d);
+
+    /// Makes the subpass render to the views in the mask (VK_KHR_multiview).
+    void setSubpassViewMask(uint32_t subpass, uint32_t viewMask);
 private:
     VkRenderPassCreateInfo  ci;
+    VkRenderPassMultiviewCreateInfo multiview;
+    uint32_t                viewMasks[MAX_SUBPASSES];
     VkSubpassDescription    subpasses[MAX_SUBPASSES];
     VkAttachmentDescription attachments[MAX_ATTACHMENTS];
     VkAttachmentReference   depthRefs[MAX_SUBPASSES];
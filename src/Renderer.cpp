@@ -272,12 +272,19 @@ bool Renderer::checkPhysicalDeviceExtensionSupport(VkPhysicalDevice pd) {
 }
 
 bool Renderer::checkPhysicalDeviceFeatures(VkPhysicalDevice pd) {
+    VkPhysicalDeviceVulkan11Features vulkan11Features = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES};
     VkPhysicalDeviceVulkan12Features vulkan12Features = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES};
     VkPhysicalDeviceFeatures2 features = {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2};
     features.pNext = &vulkan12Features;
+    vulkan12Features.pNext = &vulkan11Features;
 
     vkGetPhysicalDeviceFeatures2(pd, &features);
 
+    #define CHECKFEATUREVK11(f) \
+        if (!vulkan11Features.f) {\
+            std::cerr << std::format("VkPhysicalDeviceVulkan11Features::" #f " is not supported by {}.\n", deviceProperties.deviceName);\
+            return false;\
+        }
     #define CHECKFEATUREVK12(f) \
         if (!vulkan12Features.f) {\
             std::cerr << std::format("VkPhysicalDeviceVulkan12Features::" #f " is not supported by {}.\n", deviceProperties.deviceName);\
@@ -297,6 +304,13 @@ bool Renderer::checkPhysicalDeviceFeatures(VkPhysicalDevice pd) {
     CHECKFEATURE2(depthClamp);
     #undef CHECKFEATURE2
 
+    // Not having these only turns off the features that use them.
+    optionalFeatures.multiview     = vulkan11Features.multiview;
+    optionalFeatures.indirectCount = vulkan12Features.drawIndirectCount
+                                  && features.features.multiDrawIndirect
+                                  && features.features.drawIndirectFirstInstance;
+    optionalFeatures.clipDistance  = features.features.shaderClipDistance;
+
     if (settings.needTimestamps && deviceProperties.limits.timestampPeriod == 0) {
         std::cerr << std::format("{} does not support timestamp queries.", deviceProperties.deviceName);
         return false;
@@ -334,11 +348,20 @@ void Renderer::createDevice() {
     vulkan12Features.descriptorBindingPartiallyBound = true;
     vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = true;
     vulkan12Features.shaderSampledImageArrayNonUniformIndexing = true;
+    vulkan12Features.drawIndirectCount = optionalFeatures.indirectCount; // For GPU culling.
+
+    // Single pass cube shadow maps.
+    VkPhysicalDeviceVulkan11Features vulkan11Features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES };
+    vulkan11Features.multiview = optionalFeatures.multiview;
+    vulkan12Features.pNext = &vulkan11Features;
 
     VkPhysicalDeviceFeatures2 deviceFeatures2 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
     deviceFeatures2.pNext = &vulkan12Features;
     deviceFeatures2.features.geometryShader = true;
     deviceFeatures2.features.depthClamp = true;
+    deviceFeatures2.features.multiDrawIndirect = optionalFeatures.indirectCount;         // One draw call per pipeline bucket.
+    deviceFeatures2.features.drawIndirectFirstInstance = optionalFeatures.indirectCount; // Draw data index.
+    deviceFeatures2.features.shaderClipDistance = optionalFeatures.clipDistance;         // Paraboloid shadow map halves.
 
     VkDeviceCreateInfo createInfo = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
     createInfo.pNext = &deviceFeatures2;
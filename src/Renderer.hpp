@@ -20,8 +20,16 @@
 #include "GfxSettings.hpp"
 #include "Swapchain.hpp"
 
+/// Device features the renderer can do without. They are enabled
+/// when the device has them, the features using them are turned off otherwise.
+struct OptionalFeatures {
+    bool multiview;     // Single pass cube shadow maps.
+    bool indirectCount; // multiDrawIndirect, drawIndirectFirstInstance and drawIndirectCount, for GPU culled draws.
+    bool clipDistance;  // Dual-paraboloid shadow maps.
+};
+
 class Renderer {
-    static const uint32_t MAX_TIMESTAMP_QUERY_COUNT = 2;
+    static const uint32_t MAX_TIMESTAMP_QUERY_COUNT = 4; // Frame and shadow map passes.
     friend Swapchain;
 public:
     Renderer(const char* appName, const GfxSettings& settings);
@@ -46,6 +54,7 @@ public:
     VkQueue          getQueue()                  const { return gfxQueue;               }
     VkFormat         getBestDepthFormat()        const { return bestDepthFormat;        }
     VkFormat         getBestDepthStencilFormat() const { return bestDepthStencilFormat; }
+    const OptionalFeatures& getOptionalFeatures() const { return optionalFeatures; }
 private:
     void createWindow();
     void fetchNeededExtensions();
@@ -91,6 +100,7 @@ private:
     VkFormat bestDepthStencilFormat;
 
     VkPhysicalDeviceProperties deviceProperties;
+    OptionalFeatures           optionalFeatures;
 
     std::unique_ptr<Swapchain> swapchain;
 
@@ -8,12 +8,19 @@
 #include "Scene.hpp"
 #include "Vertex.hpp"
 #include "CommonSamplers.hpp"
+#include "WorkerPool.hpp"
+#include "GeometryCache.hpp"
 #include <stb_image.h>
 #include <dds.hpp>
 #include <stdexcept>
 #include <iostream>
 #include <format>
 #include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <tuple>
+#include <bit>
 
 static bool tinygltf_load_image_callback(tinygltf::Image* image, const int imageIdx, std::string* err,
                                   std::string* warn, int reqWidth, int reqHeight,
@@ -31,9 +38,11 @@ static bool tinygltf_load_image_callback(tinygltf::Image* image, const int image
     return r;
 }
 
-Scene::Scene(Renderer& renderer, const ScenePipelines& pipelines, const std::string& filename)
+Scene::Scene(Renderer& renderer, const ScenePipelines& pipelines, GeometryArena& geometry, const std::string& filename, const VIBConf& meshConf)
     : renderer(renderer)
     , pipelines(pipelines)
+    , geometry(geometry)
+    , meshConf(meshConf)
     , shadowMapConf({512, true, 512, 4, 0.1})
 {
     if (filename.size() < 4) {
@@ -68,14 +77,52 @@ Scene::Scene(Renderer& renderer, const ScenePipelines& pipelines, const std::str
         return;
     }
 
-    lightNodeID  = -1;
-    cameraNodeID = -1;
+    lightNodeID    = -1;
+    cameraNodeID   = -1;
+    frustumCulling = true;
+    indirectDraws  = true;
+    gpuCulling     = true;
+    shadowMapCaching = true;
+    shadowFaceBudget = 0;
+    drawStats      = {};
+    shadowMapConf  = {};
+    nodeDataDirty  = false;
+    shadowCasterLayer = eShadowCasters_All;
 
     allocateBuffers();
-    loadMeshes();
+    loadMeshes(filename);
     loadMaterials();
     loadNodes();
+    groupInstances();
     loadAnimations();
+    buildAllDrawPackets();
+}
+
+Scene::~Scene() {
+    for (const auto& mesh : meshes) {
+        geometry.free(mesh.geometry);
+    }
+}
+
+/// Moves the group offsets of a mesh from one placement in the arena to another.
+static void rebase_groups(std::vector<VIBPrimGroup>& groups, const GeometryArena::Allocation& from, const GeometryArena::Allocation& to) {
+    for (auto& group : groups) {
+        // Index ranges are counted in 4 byte units, which hold one or two indices.
+        const uint32_t perUnit = sizeof(uint32_t) / index_type_size(group.indexType);
+        group.vertexOffset       += int32_t(to.vertices.offset) - int32_t(from.vertices.offset);
+        group.firstIndex         += (to.indices.offset - from.indices.offset) * perUnit;
+        group.firstEdgeIndex     += (to.edges.offset   - from.edges.offset)   * perUnit;
+        group.firstEdgeLineIndex += (to.edges.offset   - from.edges.offset)   * perUnit;
+    }
+}
+
+void Scene::relocateGeometry() {
+    for (auto& mesh : meshes) {
+        const auto& placement = geometry.get(mesh.geometry);
+        rebase_groups(mesh.primGroups, mesh.placement, placement);
+        mesh.placement = placement;
+    }
+    buildAllDrawPackets();
 }
 
 void Scene::fillOutBindlessSet(BindlessSet& set) {
@@ -85,6 +132,15 @@ void Scene::fillOutBindlessSet(BindlessSet& set) {
     }
 }
 
+// vkCmdUpdateBuffer takes at most 64 KiB at once.
+static void record_buffer_update(VkCommandBuffer cmdbuf, VkBuffer buffer, uint64_t size, const void* data) {
+    constexpr uint64_t MAX_UPDATE_SIZE = 65536;
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    for (uint64_t offset = 0; offset < size; offset += MAX_UPDATE_SIZE) {
+        vkCmdUpdateBuffer(cmdbuf, buffer, offset, std::min(size - offset, MAX_UPDATE_SIZE), bytes + offset);
+    }
+}
+
 void Scene::recordDrawBufferUpdates(VkCommandBuffer cmdbuf) {
     VkBufferMemoryBarrier before[] = {
         cameraBuffer->getBarrier(
@@ -110,70 +166,375 @@ void Scene::recordDrawBufferUpdates(VkCommandBuffer cmdbuf) {
             0, lights.size()*sizeof(LightData)
         ),
     };
-    vkCmdPipelineBarrier(cmdbuf, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+    vkCmdPipelineBarrier(cmdbuf, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT|VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
                          0, 0, nullptr, ARRAY_COUNT(before), before, 0, nullptr);
     vkCmdUpdateBuffer(cmdbuf, *cameraBuffer, 0, before[0].size, &camera);
     vkCmdUpdateBuffer(cmdbuf, *lightBuffer, 0, before[1].size, lights.data());
     vkCmdPipelineBarrier(cmdbuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT|VK_PIPELINE_STAGE_GEOMETRY_SHADER_BIT,
                          0, 0, nullptr, ARRAY_COUNT(after), after, 0, nullptr);
+
+    // Transforms only change with animations.
+    if (nodeDataDirty && !nodeData.empty()) {
+        const uint32_t size = uint32_t(nodeData.size() * sizeof(NodeData));
+        VkBufferMemoryBarrier nodeBefore = nodeBuffer->getBarrier(VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, 0, size);
+        VkBufferMemoryBarrier nodeAfter  = nodeBuffer->getBarrier(VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, 0, size);
+        // Read by the vertex shaders and the culling pass.
+        const VkPipelineStageFlags readers = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT|VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        vkCmdPipelineBarrier(cmdbuf, readers, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 0, nullptr, 1, &nodeBefore, 0, nullptr);
+        record_buffer_update(cmdbuf, *nodeBuffer, size, nodeData.data());
+        vkCmdPipelineBarrier(cmdbuf, VK_PIPELINE_STAGE_TRANSFER_BIT, readers,
+                             0, 0, nullptr, 1, &nodeAfter, 0, nullptr);
+    }
+    nodeDataDirty = false;
 }
 
-void Scene::recordMeshDraw(VkCommandBuffer cmdbuf, int meshID, uint32_t baseFlags, eSceneDrawType drawType) {
-    const auto& mesh = meshes[meshID];
-    for (const auto& group : mesh.primGroups) {
-        uint32_t flags = baseFlags;
+void Scene::buildDrawPackets(eSceneDrawType drawType) {
+    auto& packets = drawPackets[drawType];
+    packets.clear();
+    uint32_t drawID = 0;
+    for (const auto& instances : meshInstances) {
+        const auto& mesh = meshes[instances.meshID];
+        for (const auto& group : mesh.primGroups) {
+            if (group.indexCount == 0)
+                continue;
 
-        pushConstants.material = materialBuffer->getGpuAddress(); // Use default material if no material is assigned to mesh
-        if (group.materialID < gltfModel.materials.size()) {
-            pushConstants.material += sizeof(MaterialData) * (group.materialID + 1);
+            DrawPacket packet;
+            packet.flags    = 0;
+            packet.material = materialBuffer->getGpuAddress(); // Use default material if no material is assigned to mesh
+            if (group.materialID < gltfModel.materials.size()) {
+                packet.material += sizeof(MaterialData) * (group.materialID + 1);
 
-            const auto& gltfMaterial = gltfModel.materials[group.materialID];
-            if (!gltfMaterial.doubleSided) {
-                if (drawType == eSceneDrawType_ShadowMap && shadowMapConf.cullFrontFaces) {
-                    flags |= eScenePipelineFlags_CullFrontFace;
-                } else {
-                    flags |= eScenePipelineFlags_CullBackFace;
+                const auto& gltfMaterial = gltfModel.materials[group.materialID];
+                if (!gltfMaterial.doubleSided) {
+                    if (drawType == eSceneDrawType_ShadowMap && shadowMapConf.cullFrontFaces) {
+                        packet.flags |= eScenePipelineFlags_CullFrontFace;
+                    } else {
+                        packet.flags |= eScenePipelineFlags_CullBackFace;
+                    }
+                }
+                switch (gltfMaterial.alphaMode[0]) {
+                case 'M': // "MASK"
+                    packet.flags |= eScenePipelineFlags_EnableAlphaTest;
+                    break;
+                case 'B': // "BLEND"
+                    packet.flags |= eScenePipelineFlags_EnableBlend;
+                    break;
                 }
             }
-            switch (gltfMaterial.alphaMode[0]) {
-            case 'M': // "MASK"
-                flags |= eScenePipelineFlags_EnableAlphaTest;
-                break;
-            case 'B': // "BLEND"
-                flags |= eScenePipelineFlags_EnableBlend;
-                break;
-            }
+            packet.firstNode     = instances.firstNode;
+            packet.instanceCount = instances.nodeCount;
+            packet.drawID        = drawID;
+            drawID += instances.nodeCount;
+            packet.indexType    = group.indexType;
+            packet.indexCount   = group.indexCount;
+            packet.firstIndex   = group.firstIndex;
+            packet.vertexOffset = group.vertexOffset;
+            packets.push_back(packet);
+        }
+    }
+
+    // Blended draws go last, the rest is grouped by pipeline, index
+    // buffer binding and material. Draws that compare equal keep the
+    // node order.
+    const auto key = [](const DrawPacket& p) {
+        return std::tuple(bool(p.flags & eScenePipelineFlags_EnableBlend), p.flags, p.indexType, p.material);
+    };
+    std::stable_sort(packets.begin(), packets.end(), [&](const DrawPacket& a, const DrawPacket& b) {
+        return key(a) < key(b);
+    });
+
+    // The same in a form the GPU can draw by itself.
+    auto& buckets  = drawBuckets[drawType];
+    auto& commands = drawCommands[drawType];
+    buckets.clear();
+    commands.clear();
+    commandBuckets[drawType].clear();
+    for (uint32_t p = 0; p < packets.size(); ++p) {
+        const auto& packet = packets[p];
+        if (buckets.empty() || buckets.back().flags != packet.flags || buckets.back().indexType != packet.indexType) {
+            buckets.push_back({ packet.flags, packet.indexType, p, 0 });
         }
+        buckets.back().count++;
+        commandBuckets[drawType].emplace_back(uint32_t(buckets.size() - 1), buckets.back().first);
+
+        VkDrawIndexedIndirectCommand command;
+        command.indexCount    = packet.indexCount;
+        command.instanceCount = packet.instanceCount;
+        command.firstIndex    = packet.firstIndex;
+        command.vertexOffset  = packet.vertexOffset;
+        command.firstInstance = packet.drawID;
+        commands.push_back(command);
+    }
+
+    if (drawType == eSceneDrawType_ShadowMap) {
+        packetsCullFrontFaces = shadowMapConf.cullFrontFaces;
+    }
+}
+
+void Scene::buildAllDrawPackets() {
+    for (uint32_t drawType = 0; drawType < eSceneDrawTypeCount; ++drawType) {
+        buildDrawPackets(eSceneDrawType(drawType));
+    }
+
+    // Every list has the same draws, just in a different order.
+    const uint64_t commandCount = drawPackets[0].size();
+    uint64_t drawCount = 0;
+    for (const auto& packet : drawPackets[0]) {
+        drawCount += packet.instanceCount;
+    }
+    drawData.resize(drawCount);
+    for (const auto& packet : drawPackets[0]) {
+        for (uint32_t k = 0; k < packet.instanceCount; ++k) {
+            auto& draw = drawData[packet.drawID + k];
+            draw.material = packet.material;
+            draw.nodeID   = instanceNodes[packet.firstNode + k];
+        }
+    }
+
+    drawBuffer        = std::make_unique<GpuShaderBuffer>(renderer, sizeof(DrawData) * std::max<uint64_t>(drawCount, 1));
+    drawIndexBuffer   = std::make_unique<GpuShaderBuffer>(renderer, sizeof(uint32_t) * std::max<uint64_t>(drawCount, 1));
+    culledDrawIndices = std::make_unique<GpuShaderBuffer>(renderer, sizeof(uint32_t) * std::max<uint64_t>(drawCount * CULL_VIEW_COUNT, 1));
+    pushConstants.draws       = drawBuffer->getGpuAddress();
+    pushConstants.drawIndices = drawIndexBuffer->getGpuAddress();
+
+    const uint64_t commandsSize = sizeof(VkDrawIndexedIndirectCommand) * commandCount;
+    const uint64_t bucketsSize  = sizeof(glm::uvec2) * commandCount;
+    const uint64_t drawDataSize = sizeof(DrawData) * drawCount;
+    const uint64_t indicesSize  = sizeof(uint32_t) * drawCount;
+    const uint64_t listSize     = commandsSize + bucketsSize;
+    culledCommands = std::make_unique<GpuShaderBuffer>(renderer, std::max<uint64_t>(commandsSize * CULL_VIEW_COUNT, 1), GpuBuffer::USAGE_INDIRECT);
+    drawCounts     = std::make_unique<GpuShaderBuffer>(renderer, std::max<uint64_t>(sizeof(uint32_t) * commandCount * CULL_VIEW_COUNT, 1), GpuBuffer::USAGE_INDIRECT);
+
+    GpuStagingBuffer staging(renderer, std::max<uint64_t>(drawDataSize + indicesSize + listSize * eSceneDrawTypeCount, 1));
+    uint8_t* mapped = reinterpret_cast<uint8_t*>(staging.getMappedData());
+    memcpy(mapped, drawData.data(), drawDataSize);
+    uint32_t* indices = reinterpret_cast<uint32_t*>(mapped + drawDataSize);
+    for (uint32_t i = 0; i < drawCount; ++i) {
+        indices[i] = i;
+    }
+    mapped += drawDataSize + indicesSize;
+    for (uint32_t drawType = 0; drawType < eSceneDrawTypeCount; ++drawType) {
+        commandBuffers[drawType]       = std::make_unique<GpuShaderBuffer>(renderer, std::max<uint64_t>(commandsSize, 1), GpuBuffer::USAGE_INDIRECT);
+        commandBucketBuffers[drawType] = std::make_unique<GpuShaderBuffer>(renderer, std::max<uint64_t>(bucketsSize, 1));
+        memcpy(mapped + listSize * drawType, drawCommands[drawType].data(), commandsSize);
+        memcpy(mapped + listSize * drawType + commandsSize, commandBuckets[drawType].data(), bucketsSize);
+    }
+    renderer.recordOneTime([&](VkCommandBuffer cmdbuf) {
+        if (drawCount == 0)
+            return;
+        drawBuffer->copyFrom(cmdbuf, staging, drawDataSize, 0);
+        drawIndexBuffer->copyFrom(cmdbuf, staging, indicesSize, drawDataSize);
+        for (uint32_t drawType = 0; drawType < eSceneDrawTypeCount; ++drawType) {
+            const uint64_t listOffset = drawDataSize + indicesSize + listSize * drawType;
+            commandBuffers[drawType]->copyFrom(cmdbuf, staging, commandsSize, listOffset);
+            commandBucketBuffers[drawType]->copyFrom(cmdbuf, staging, bucketsSize, listOffset + commandsSize);
+        }
+    });
+}
+
+void Scene::recordDrawCommandsUpdate(VkCommandBuffer cmdbuf, eSceneDrawType drawType) {
+    auto& commands = *commandBuffers[drawType];
+    auto& buckets  = *commandBucketBuffers[drawType];
+    const uint32_t commandsSize = uint32_t(drawCommands[drawType].size() * sizeof(VkDrawIndexedIndirectCommand));
+    const uint32_t bucketsSize  = uint32_t(commandBuckets[drawType].size() * sizeof(glm::uvec2));
+    if (commandsSize == 0)
+        return;
+
+    // Read by indirect draws and the culling pass.
+    const VkPipelineStageFlags readers = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    VkBufferMemoryBarrier before[] = {
+        commands.getBarrier(VK_ACCESS_INDIRECT_COMMAND_READ_BIT|VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, 0, commandsSize),
+        buckets.getBarrier(VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, 0, bucketsSize),
+    };
+    VkBufferMemoryBarrier after[] = {
+        commands.getBarrier(VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT|VK_ACCESS_SHADER_READ_BIT, 0, commandsSize),
+        buckets.getBarrier(VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, 0, bucketsSize),
+    };
+    vkCmdPipelineBarrier(cmdbuf, readers, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 0, nullptr, ARRAY_COUNT(before), before, 0, nullptr);
+    record_buffer_update(cmdbuf, commands, commandsSize, drawCommands[drawType].data());
+    record_buffer_update(cmdbuf, buckets, bucketsSize, commandBuckets[drawType].data());
+    vkCmdPipelineBarrier(cmdbuf, VK_PIPELINE_STAGE_TRANSFER_BIT, readers,
+                         0, 0, nullptr, ARRAY_COUNT(after), after, 0, nullptr);
+}
+
+// Push constants of cull.comp.
+struct CullConstants {
+    glm::vec4       sphere;
+    VkDeviceAddress camera;
+    VkDeviceAddress nodes;
+    VkDeviceAddress draws;
+    VkDeviceAddress commands;
+    VkDeviceAddress buckets;
+    VkDeviceAddress culled;
+    VkDeviceAddress counts;
+    VkDeviceAddress indices;
+    uint32_t        commandCount;
+    uint32_t        casters; // eShadowCasters
+    uint32_t        culling; // Scene::frustumCulling
+};
+static_assert(sizeof(CullConstants) <= 128);
+
+void Scene::recordCulling(VkCommandBuffer cmdbuf) {
+    if (indirectDraws && gpuCulling) {
+        recordCullDispatch(cmdbuf, eSceneDrawType_Full, CULL_VIEW_CAMERA);
+    }
+}
+
+void Scene::recordCullDispatch(VkCommandBuffer cmdbuf, eSceneDrawType drawType, uint32_t view, const glm::vec4& sphere, eShadowCasters casters) {
+    const uint32_t commandCount = uint32_t(drawCommands[drawType].size());
+    if (commandCount == 0)
+        return;
+    const uint64_t countsOffset   = sizeof(uint32_t) * commandCount * view;
+    const uint64_t commandsOffset = sizeof(VkDrawIndexedIndirectCommand) * commandCount * view;
+    const uint64_t indicesOffset  = sizeof(uint32_t) * drawData.size() * view;
+
+    // The previous draws from this view have to be done, and the camera
+    // and draw data updates visible.
+    VkMemoryBarrier before = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    before.srcAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    before.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmdbuf,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &before, 0, nullptr, 0, nullptr);
+    vkCmdFillBuffer(cmdbuf, *drawCounts, countsOffset, sizeof(uint32_t) * commandCount, 0);
+
+    VkMemoryBarrier cleared = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    cleared.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    cleared.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmdbuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &cleared, 0, nullptr, 0, nullptr);
 
-        VkPipeline pipeline = VK_NULL_HANDLE;
+    CullConstants constants;
+    constants.sphere       = sphere;
+    constants.camera       = cameraBuffer->getGpuAddress();
+    constants.nodes        = nodeBuffer->getGpuAddress();
+    constants.draws        = drawBuffer->getGpuAddress();
+    constants.commands     = commandBuffers[drawType]->getGpuAddress();
+    constants.buckets      = commandBucketBuffers[drawType]->getGpuAddress();
+    constants.culled       = culledCommands->getGpuAddress() + commandsOffset;
+    constants.counts       = drawCounts->getGpuAddress() + countsOffset;
+    constants.indices      = culledDrawIndices->getGpuAddress() + indicesOffset;
+    constants.commandCount = commandCount;
+    constants.casters      = casters;
+    constants.culling      = frustumCulling;
+    vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines.cullDraws);
+    vkCmdPushConstants(cmdbuf, pipelines.cullLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+    vkCmdDispatch(cmdbuf, (commandCount + 63) / 64, 1, 1);
+
+    VkMemoryBarrier after = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    after.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    after.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmdbuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                         0, 1, &after, 0, nullptr, 0, nullptr);
+}
+
+void Scene::updateNodeData() {
+    for (auto i : nodeDrawOrder) {
+        const auto& bounds = nodes[i].bounds;
+        auto& data = nodeData[i];
+        data.transform = getDrawTransform(i);
+        data.boundsMin = glm::vec4(bounds.min, meshes[gltfModel.nodes[i].mesh].hasBounds ? 1.0f : 0.0f);
+        data.boundsMax = glm::vec4(bounds.max, nodes[i].dynamic ? 1.0f : 0.0f);
+    }
+    nodeDataDirty = true;
+}
+
+void Scene::recordDrawPackets(VkCommandBuffer cmdbuf, eSceneDrawType drawType, uint32_t baseFlags, uint32_t& drawn, uint32_t& culled,
+                              uint64_t& triangles, const VkPipeline* pipelineTable) {
+    if (pipelineTable == nullptr) {
         switch (drawType) {
         default:
         case eSceneDrawType_Full:
-            pipeline = pipelines.scene[flags];
+            pipelineTable = pipelines.scene;
             break;
         case eSceneDrawType_ShadowMapped:
-            pipeline = pipelines.sceneShadowMapped[flags];
+            pipelineTable = pipelines.sceneShadowMapped;
             break;
         case eSceneDrawType_ShadowMap:
-            pipeline = pipelines.shadowMap[flags];
+            pipelineTable = pipelines.shadowMap;
             break;
         case eSceneDrawType_Ambient:
-            pipeline = pipelines.sceneAmbientOnly[flags];
+            pipelineTable = pipelines.sceneAmbientOnly;
             break;
         case eSceneDrawType_DiffuseStencilTested:
-            pipeline = pipelines.sceneDiffuseOnlyST[flags];
+            pipelineTable = pipelines.sceneDiffuseOnlyST;
             break;
         }
+    }
 
-        if (pipeline != lastBoundPipeline) {
-            lastBoundPipeline = pipeline;
-            vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    const bool     gpuCulled = indirectDraws && gpuCulling;
+    const uint32_t view      = (drawType == eSceneDrawType_ShadowMap) ? CULL_VIEW_SHADOW : CULL_VIEW_CAMERA;
+
+    // Transforms and materials come from the draw data, so the push
+    // constants stay the same for the whole pass.
+    pushConstants.drawIndices = gpuCulled
+                              ? culledDrawIndices->getGpuAddress() + sizeof(uint32_t) * drawData.size() * view
+                              : drawIndexBuffer->getGpuAddress();
+    vkCmdPushConstants(cmdbuf, pipelines.layout, VK_SHADER_STAGE_ALL_GRAPHICS, 0, sizeof(PushConstants), &pushConstants);
+    pushConstants.drawIndices = drawIndexBuffer->getGpuAddress();
+
+    // The buckets hold every instance, only the compute pass can cull
+    // them. Without it, draw directly so that nodeVisible still applies.
+    if (gpuCulled) {
+        const uint32_t listSize = uint32_t(drawCommands[drawType].size());
+        const auto&    buckets  = drawBuckets[drawType];
+        for (uint32_t b = 0; b < buckets.size(); ++b) {
+            const auto& bucket = buckets[b];
+            VkPipeline pipeline = pipelineTable[bucket.flags | baseFlags];
+            if (pipeline != lastBoundPipeline) {
+                lastBoundPipeline = pipeline;
+                vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+            }
+            if (bucket.indexType != boundIndexType) {
+                boundIndexType = bucket.indexType;
+                geometry.bindIndexBuffer(cmdbuf, bucket.indexType);
+            }
+            // Each bucket's visible commands start where its full list does.
+            vkCmdDrawIndexedIndirectCount(cmdbuf,
+                                          *culledCommands, (listSize * view + bucket.first) * sizeof(VkDrawIndexedIndirectCommand),
+                                          *drawCounts,     (listSize * view + b) * sizeof(uint32_t),
+                                          bucket.count, sizeof(VkDrawIndexedIndirectCommand));
+            drawn += bucket.count;
+            for (uint32_t c = bucket.first; c < bucket.first + bucket.count; ++c) {
+                const auto& command = drawCommands[drawType][c];
+                triangles += uint64_t(command.indexCount / 3) * command.instanceCount;
+            }
         }
+        return;
+    }
+
+    for (const auto& packet : drawPackets[drawType]) {
+        const int* packetNodes = &instanceNodes[packet.firstNode];
+        uint32_t k = 0;
+        while (k < packet.instanceCount) {
+            if (!nodeVisible[packetNodes[k]]) {
+                culled++;
+                k++;
+                continue;
+            }
+            const uint32_t first = k;
+            while (k < packet.instanceCount && nodeVisible[packetNodes[k]]) {
+                k++;
+            }
+            drawn++;
 
-        mesh.buffer.bindVertexBuffer(cmdbuf, 0, group.vertexOffset);
-        mesh.buffer.bindIndexBuffer(cmdbuf, group.indexOffset, VK_INDEX_TYPE_UINT32);
-        vkCmdPushConstants(cmdbuf, pipelines.layout, VK_SHADER_STAGE_ALL_GRAPHICS, 0, sizeof(PushConstants), &pushConstants);
-        vkCmdDrawIndexed(cmdbuf, group.indexCount, 1, 0, 0, 0);
+            VkPipeline pipeline = pipelineTable[packet.flags | baseFlags];
+            if (pipeline != lastBoundPipeline) {
+                lastBoundPipeline = pipeline;
+                vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+            }
+
+            if (packet.indexType != boundIndexType) {
+                boundIndexType = packet.indexType;
+                geometry.bindIndexBuffer(cmdbuf, packet.indexType);
+            }
+
+            vkCmdDrawIndexed(cmdbuf, packet.indexCount, k - first, packet.firstIndex, packet.vertexOffset, packet.drawID + first);
+            triangles += uint64_t(packet.indexCount / 3) * (k - first);
+        }
     }
 }
 
@@ -184,10 +545,15 @@ void Scene::recordScene(VkCommandBuffer cmdbuf, uint32_t baseFlags, eSceneDrawTy
     pushConstants.lights = lightBuffer->getGpuAddress();
     pushConstants.lightCount = lights.size();
 
+    const Frustum frustum(camera.projView);
     for (auto i : nodeDrawOrder) {
-        pushConstants.transform = nodes[i].globalTransform;
-        recordMeshDraw(cmdbuf, gltfModel.nodes[i].mesh, baseFlags, drawType);
+        const auto& mesh = meshes[gltfModel.nodes[i].mesh];
+        nodeVisible[i] = !frustumCulling || !mesh.hasBounds || frustum.intersects(nodes[i].bounds);
     }
+
+    geometry.bindVertexBuffer(cmdbuf);
+    boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+    recordDrawPackets(cmdbuf, drawType, baseFlags, drawStats.drawn, drawStats.culled, drawStats.triangles);
 }
 
 void Scene::recordShadowVolumesStencil(VkCommandBuffer cmdbuf, eSVMethod method, uint32_t lightID) {
@@ -198,48 +564,51 @@ void Scene::recordShadowVolumesStencil(VkCommandBuffer cmdbuf, eSVMethod method,
     pushConstants.lightCount = lights.size();
     pushConstants.currentLightID = lightID;
     
-    VkPipeline passes  [3] = {VK_NULL_HANDLE};
-    bool       useEdges[3] = {false};
+    VkPipeline passes    [3] = {VK_NULL_HANDLE};
+    VkPipeline linePasses[3] = {VK_NULL_HANDLE}; // For the compact 2-face edge stream.
+    bool       useEdges  [3] = {false};
     switch (method) {
     case eSVMethod_DepthPass:
         passes[0] = pipelines.svDPass;
         break;
     case eSVMethod_SilhoutteDepthPass:
-        passes  [0] = pipelines.svDPassSilhoutte;
-        useEdges[0] = true;
+        passes    [0] = pipelines.svDPassSilhoutte;
+        linePasses[0] = pipelines.svDPassSilhoutteLines;
+        useEdges  [0] = true;
         break;
     case eSVMethod_DepthFail:
         passes[0] = pipelines.svDFailFrontCap;
         passes[1] = pipelines.svDFailSidesBackCap;
         break;
     case eSVMethod_SilhoutteDepthFail:
-        passes  [0] = pipelines.svDFailFrontCap;
-        passes  [1] = pipelines.svDFailSilhoutte;
-        useEdges[1] = true;
-        passes  [2] = pipelines.svDFailBackCap;
+        passes    [0] = pipelines.svDFailFrontCap;
+        passes    [1] = pipelines.svDFailSilhoutte;
+        linePasses[1] = pipelines.svDFailSilhoutteLines;
+        useEdges  [1] = true;
+        passes    [2] = pipelines.svDFailBackCap;
         break;
     }
+    if (!meshConf.compactEdges) {
+        std::fill(std::begin(linePasses), std::end(linePasses), VK_NULL_HANDLE);
+    }
 
+    geometry.bindPositionBuffer(cmdbuf);
     for (uint32_t passOrder = 0; passOrder < ARRAY_COUNT(passes); ++passOrder) {
         auto p = passes[passOrder];
         if (p == VK_NULL_HANDLE)
             break;
         vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, p);
-        for (auto i : nodeDrawOrder) {
-            pushConstants.transform = nodes[i].globalTransform;
-            vkCmdPushConstants(cmdbuf, pipelines.layout, VK_SHADER_STAGE_ALL_GRAPHICS, 0, sizeof(pushConstants), &pushConstants);
-
-            const auto& mesh = meshes[gltfModel.nodes[i].mesh];
-            for (const auto& group : mesh.primGroups) {
-                mesh.buffer.bindVertexBuffer(cmdbuf, 0, group.vertexOffset);
-                if (useEdges[passOrder]) {
-                    mesh.buffer.bindIndexBuffer(cmdbuf, group.edgeIndexOffset, VK_INDEX_TYPE_UINT32);
-                    vkCmdDrawIndexed(cmdbuf, group.edgeIndexCount, 1, 0, 0, 0);
-                } else {
-                    mesh.buffer.bindIndexBuffer(cmdbuf, group.indexOffset, VK_INDEX_TYPE_UINT32);
-                    vkCmdDrawIndexed(cmdbuf, group.indexCount, 1, 0, 0, 0);
-                }
-            }
+        if (useEdges[passOrder]) {
+            recordIndexStream(cmdbuf, true, &VIBPrimGroup::firstEdgeIndex, &VIBPrimGroup::edgeIndexCount);
+        } else {
+            recordIndexStream(cmdbuf, false, &VIBPrimGroup::firstIndex, &VIBPrimGroup::indexCount);
+        }
+
+        // Edges with exactly two faces come as lines with adjacency
+        // and need their own pipeline.
+        if (linePasses[passOrder] != VK_NULL_HANDLE) {
+            vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, linePasses[passOrder]);
+            recordIndexStream(cmdbuf, true, &VIBPrimGroup::firstEdgeLineIndex, &VIBPrimGroup::edgeLineIndexCount);
         }
     }
 }
@@ -251,77 +620,738 @@ void Scene::recordSilhoutteDebugOverlay(VkCommandBuffer cmdbuf, uint32_t lightID
     pushConstants.lightCount     = lights.size();
     pushConstants.currentLightID = lightID;
     vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.silhoutteDebug);
-    for (auto i : nodeDrawOrder) {
-        pushConstants.transform = nodes[i].globalTransform;
-        vkCmdPushConstants(cmdbuf, pipelines.layout, VK_SHADER_STAGE_ALL_GRAPHICS, 0, sizeof(pushConstants), &pushConstants);
-
-        const auto& mesh = meshes[gltfModel.nodes[i].mesh];
-        for (const auto& group : mesh.primGroups) {
-            mesh.buffer.bindVertexBuffer(cmdbuf, 0, group.vertexOffset);
-            mesh.buffer.bindIndexBuffer(cmdbuf, group.edgeIndexOffset, VK_INDEX_TYPE_UINT32);
-            vkCmdDrawIndexed(cmdbuf, group.edgeIndexCount, 1, 0, 0, 0);
-        }
+    geometry.bindPositionBuffer(cmdbuf);
+    recordIndexStream(cmdbuf, true, &VIBPrimGroup::firstEdgeIndex, &VIBPrimGroup::edgeIndexCount);
+    if (meshConf.compactEdges) {
+        vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines.silhoutteDebugLines);
+        recordIndexStream(cmdbuf, true, &VIBPrimGroup::firstEdgeLineIndex, &VIBPrimGroup::edgeLineIndexCount);
     }
 }
 
-void Scene::drawToShadowMaps(VkCommandBuffer cmdbuf, BindlessSet& set) {
-    lastBoundPipeline = VK_NULL_HANDLE;
-    pushConstants.camera = cameraBuffer->getGpuAddress();
-    if (shadowMaps.size() != lights.size()) {
-        uint32_t howMany = lights.size() - shadowMaps.size();
-        for (uint32_t i = 0; i < howMany; ++i) {
-            shadowMaps.emplace_back(renderer, pipelines.shadowMapRenderPass, shadowMapConf.resolution);
-        }
-    }
-    for (int l = 0; l < lights.size(); ++l) {
-        LightData& light = lights[l];
-        light.zNear = shadowMapConf.zNear;
-        light.zFar  = light.range;
-        for (int i = 0; i < 6; ++i) {
-            recordCubeFace(cmdbuf, l, i);
+void Scene::recordIndexStream(VkCommandBuffer cmdbuf, bool edges, uint32_t VIBPrimGroup::* first, uint32_t VIBPrimGroup::* count) {
+    vkCmdPushConstants(cmdbuf, pipelines.layout, VK_SHADER_STAGE_ALL_GRAPHICS, 0, sizeof(pushConstants), &pushConstants);
+    boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+
+    // Same draw data as the packets, assigned in the same order.
+    uint32_t drawID = 0;
+    for (const auto& instances : meshInstances) {
+        const auto& mesh = meshes[instances.meshID];
+        for (const auto& group : mesh.primGroups) {
+            if (group.indexCount == 0)
+                continue;
+            const uint32_t firstDraw = drawID;
+            drawID += instances.nodeCount;
+            if (group.*count == 0)
+                continue;
+            if (group.indexType != boundIndexType) {
+                boundIndexType = group.indexType;
+                if (edges) {
+                    geometry.bindEdgeBuffer(cmdbuf, group.indexType);
+                } else {
+                    geometry.bindIndexBuffer(cmdbuf, group.indexType);
+                }
+            }
+            vkCmdDrawIndexed(cmdbuf, group.*count, instances.nodeCount, group.*first, group.vertexOffset, firstDraw);
         }
     }
-    for (int l = 0; l < lights.size(); ++l) {
-        lights[l].shadowMap = set.addImageView(shadowMaps[l].getView());
-    }
 }
 
-void Scene::recordCubeFace(VkCommandBuffer cmdbuf, int lightID, int faceID) {
+/// View matrix of a cube shadow map face.
+static glm::mat4 cube_face_view(int faceID, const glm::vec3& position) {
     const float pi = glm::pi<float>(); // 180 degrees
     const float halfpi = pi / 2.0f;    // 90 degrees
 
-    LightData& light = lights[lightID];
-
     // View matrix calculation based on the Vulkan samples by Sascha Willems at
     // https://github.com/SaschaWillems/Vulkan/blob/master/examples/shadowmappingomni/shadowmappingomni.cpp
-    CameraData lcam;
-    lcam.projection = glm::perspective(halfpi, 1.0f, light.zNear, light.zFar);
-    lcam.view = glm::mat4(1.0f);
+    glm::mat4 view = glm::mat4(1.0f);
     switch (faceID) {
     case 0: // +X
-        lcam.view = glm::rotate(lcam.view, halfpi, {0, 1, 0});
-        lcam.view = glm::rotate(lcam.view, pi, {1, 0, 0});
+        view = glm::rotate(view, halfpi, {0, 1, 0});
+        view = glm::rotate(view, pi, {1, 0, 0});
         break;
     case 1: // -X
-        lcam.view = glm::rotate(lcam.view, -halfpi, {0, 1, 0});
-        lcam.view = glm::rotate(lcam.view, pi, {1, 0, 0});
+        view = glm::rotate(view, -halfpi, {0, 1, 0});
+        view = glm::rotate(view, pi, {1, 0, 0});
         break;
     case 2: // +Y
-        lcam.view = glm::rotate(lcam.view, -halfpi, {1, 0, 0});
+        view = glm::rotate(view, -halfpi, {1, 0, 0});
         break;
     case 3: // -Y
-        lcam.view = glm::rotate(lcam.view, halfpi, {1, 0, 0});
+        view = glm::rotate(view, halfpi, {1, 0, 0});
         break;
     case 4: // +Z
-        lcam.view = glm::rotate(lcam.view, pi, {1, 0, 0});
+        view = glm::rotate(view, pi, {1, 0, 0});
         break;
     case 5: // -Z
-        lcam.view = glm::rotate(lcam.view, pi, {0, 0, 1});
+        view = glm::rotate(view, pi, {0, 0, 1});
         break;
     }
-    lcam.view = glm::translate(lcam.view, -light.position);
+    return glm::translate(view, -position);
+}
+
+static glm::mat4 cube_face_projection(const Scene::LightData& light) {
+    return glm::perspective(glm::pi<float>() / 2.0f, 1.0f, light.zNear, light.zFar);
+}
+
+/// Directions of the tetrahedron faces, same order as in lighting.glsl.
+static const glm::vec3 tetrahedron_faces[4] = {
+    {  1,  1,  1 },
+    {  1, -1, -1 },
+    { -1,  1, -1 },
+    { -1, -1,  1 },
+};
+
+static glm::mat4 tetrahedron_face_view(int faceID, const glm::vec3& position) {
+    return glm::lookAt(position, position + tetrahedron_faces[faceID], glm::vec3(0, 1, 0));
+}
+
+/// The corners of a face are arccos(1/3) from its direction, about 70.5
+/// degrees. A square frustum that wide fits the whole face however it's
+/// turned around the direction.
+static glm::mat4 tetrahedron_face_projection(const Scene::LightData& light) {
+    return glm::perspective(2.0f * std::atan(2.0f * std::sqrt(2.0f)), 1.0f, light.zNear, light.zFar);
+}
+
+/// View of one half of a dual-paraboloid shadow map, looking down -Z like
+/// the perspective ones. The second half is turned around Y to look down
+/// +Z, lighting.glsl picks them the same way.
+static glm::mat4 paraboloid_view(int faceID, const glm::vec3& position) {
+    glm::mat4 view = glm::mat4(1.0f);
+    if (faceID == 1) {
+        view = glm::rotate(view, glm::pi<float>(), {0, 1, 0});
+    }
+    return glm::translate(view, -position);
+}
+
+static uint32_t omni_face_count(eOmniShadowMap omni) {
+    switch (omni) {
+    case eOmniShadowMap_DualParaboloid: return 2;
+    case eOmniShadowMap_Tetrahedral:    return 4;
+    default:                            return 6;
+    }
+}
+
+/// Texture size of a dual-paraboloid or tetrahedral shadow map, with the
+/// faces `resolution` large: the halves side by side or the faces in a
+/// 2x2 grid.
+static VkExtent2D omni_map_extent(eOmniShadowMap omni, uint32_t resolution) {
+    if (omni == eOmniShadowMap_DualParaboloid) {
+        return { resolution * 2, resolution };
+    }
+    return { resolution * 2, resolution * 2 };
+}
+
+static VkRect2D omni_face_area(int faceID, uint32_t resolution) {
+    return { { int32_t((faceID % 2) * resolution), int32_t((faceID / 2) * resolution) }, { resolution, resolution } };
+}
+
+/// Copies the faces in the bit mask from one shadow map to the other.
+/// Both are left in the attachment layout, ready to be drawn over.
+static void copy_cube_faces(VkCommandBuffer cmdbuf, const TextureCubeShadowMap& src, const TextureCubeShadowMap& dst, uint8_t faces) {
+    VkImageMemoryBarrier before[12];
+    VkImageMemoryBarrier after[12];
+    VkImageCopy          regions[6];
+    uint32_t barrierCount = 0;
+    uint32_t regionCount  = 0;
+    for (uint32_t i = 0; i < 6; ++i) {
+        if (!(faces & (1 << i))) {
+            continue;
+        }
+        VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.subresourceRange    = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, i, 1 };
+
+        barrier.image         = src.getImage();
+        barrier.oldLayout     = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        barrier.newLayout     = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        before[barrierCount] = barrier;
+        barrier.oldLayout     = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.newLayout     = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        after[barrierCount++] = barrier;
+
+        // The whole face gets overwritten, no need to keep its contents.
+        barrier.image         = dst.getImage();
+        barrier.oldLayout     = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout     = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        before[barrierCount] = barrier;
+        barrier.oldLayout     = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout     = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        after[barrierCount++] = barrier;
+
+        VkImageCopy& region = regions[regionCount++];
+        region.srcSubresource = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, i, 1 };
+        region.srcOffset      = { 0, 0, 0 };
+        region.dstSubresource = region.srcSubresource;
+        region.dstOffset      = { 0, 0, 0 };
+        region.extent         = { src.getWidth(), src.getHeight(), 1 };
+    }
+    if (regionCount == 0) {
+        return;
+    }
+
+    vkCmdPipelineBarrier(cmdbuf,
+                         VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 0, nullptr, 0, nullptr, barrierCount, before);
+    vkCmdCopyImage(cmdbuf,
+                   src.getImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   dst.getImage(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   regionCount, regions);
+    vkCmdPipelineBarrier(cmdbuf,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                         0, 0, nullptr, 0, nullptr, barrierCount, after);
+}
+
+void Scene::drawToShadowMaps(VkCommandBuffer cmdbuf, BindlessSet& set) {
+    lastBoundPipeline = VK_NULL_HANDLE;
+    pushConstants.camera = cameraBuffer->getGpuAddress();
+    if (shadowMapConf.cullFrontFaces != packetsCullFrontFaces) {
+        buildDrawPackets(eSceneDrawType_ShadowMap);
+        recordDrawCommandsUpdate(cmdbuf, eSceneDrawType_ShadowMap);
+    }
+    // All kinds of textures only go away when the device is idle, main()
+    // waits for it when switching modes and clears shadowMaps.
+    const bool omni = shadowMapConf.omni != eOmniShadowMap_Cube;
+    if (!omni) {
+        omniShadowMaps.clear();
+    }
+    if (shadowAtlasTexture && !shadowMapConf.atlas) {
+        shadowAtlasTexture.reset();
+        shadowAtlas.reset(0);
+        for (auto& state : shadowMapStates) {
+            std::fill(std::begin(state.tiles), std::end(state.tiles), ShadowAtlas::Tile{});
+        }
+    }
+    size_t firstNewMap = 0; // These have never been drawn to.
+    if (omni) {
+        // Ones made for another layout or resolution are replaced.
+        const VkExtent2D extent = omni_map_extent(shadowMapConf.omni, shadowMapConf.resolution);
+        while (firstNewMap < omniShadowMaps.size() &&
+               omniShadowMaps[firstNewMap]->getWidth()  == extent.width &&
+               omniShadowMaps[firstNewMap]->getHeight() == extent.height) {
+            firstNewMap++;
+        }
+        omniShadowMaps.resize(std::min(firstNewMap, lights.size()));
+        while (omniShadowMaps.size() < lights.size()) {
+            // Each face clears its own area, like the atlas tiles.
+            omniShadowMaps.push_back(std::make_unique<TextureShadowAtlas>(renderer, pipelines.shadowMapLoadRenderPass,
+                                                                          extent.width, extent.height));
+            omniShadowMaps.back()->transitionLayout(cmdbuf, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+        }
+    } else if (shadowMapConf.atlas) {
+        if (shadowAtlasTexture) {
+            firstNewMap = shadowMapStates.size();
+        } else {
+            const uint32_t size = std::bit_ceil(std::max(shadowMapConf.atlasSize, MIN_ATLAS_SIZE));
+            shadowAtlasTexture = std::make_unique<TextureShadowAtlas>(renderer, pipelines.shadowMapLoadRenderPass, size, size);
+            shadowAtlasTexture->transitionLayout(cmdbuf, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+            shadowAtlas.reset(size);
+        }
+    } else {
+        firstNewMap = shadowMaps.size();
+        if (shadowMaps.size() != lights.size()) {
+            uint32_t howMany = lights.size() - shadowMaps.size();
+            for (uint32_t i = 0; i < howMany; ++i) {
+                shadowMaps.emplace_back(renderer,
+                                        shadowMapConf.multiview ? pipelines.shadowCubeRenderPass : pipelines.shadowMapRenderPass,
+                                        shadowMapConf.resolution,
+                                        shadowMapConf.multiview);
+            }
+        }
+    }
+    // The static layers go along with the maps. Turning the layer off
+    // keeps them around though.
+    while (staticShadowMaps.size() > std::min(firstNewMap, shadowMaps.size())) {
+        staticShadowMaps.pop_back();
+    }
+    if (shadowMapConf.staticLayer && !shadowMapConf.atlas) {
+        for (size_t l = staticShadowMaps.size(); l < shadowMaps.size(); ++l) {
+            const bool layered = shadowMaps[l].isLayered();
+            staticShadowMaps.emplace_back(renderer,
+                                          layered ? pipelines.shadowCubeRenderPass : pipelines.shadowMapRenderPass,
+                                          shadowMaps[l].getWidth(),
+                                          layered);
+        }
+    }
+    for (auto& light : lights) {
+        light.zNear = shadowMapConf.zNear;
+        light.zFar  = light.range;
+    }
+    updateShadowMapStates(firstNewMap);
+    if (shadowMapConf.atlas) {
+        updateAtlasTiles();
+    }
+
+    // The face matrices of all lights go up at once for multiview. The
+    // atlas and the tetrahedral maps are sampled through them as well.
+    const bool tetrahedral = shadowMapConf.omni == eOmniShadowMap_Tetrahedral;
+    if ((shadowMapConf.multiview || shadowMapConf.atlas || tetrahedral) && !lights.empty()) {
+        glm::mat4 faces[MAX_LIGHTS * 6];
+        for (uint32_t l = 0; l < lights.size(); ++l) {
+            if (tetrahedral) {
+                const glm::mat4 projection = tetrahedron_face_projection(lights[l]);
+                for (int i = 0; i < 4; ++i) {
+                    faces[l * 6 + i] = projection * tetrahedron_face_view(i, lights[l].position);
+                }
+                continue;
+            }
+            const glm::mat4 projection = cube_face_projection(lights[l]);
+            for (int i = 0; i < 6; ++i) {
+                faces[l * 6 + i] = projection * cube_face_view(i, lights[l].position);
+            }
+        }
+        const uint32_t size = uint32_t(lights.size() * 6 * sizeof(glm::mat4));
+        VkBufferMemoryBarrier before = cubeFaceBuffer->getBarrier(VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, 0, size);
+        VkBufferMemoryBarrier after  = cubeFaceBuffer->getBarrier(VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, 0, size);
+        vkCmdPipelineBarrier(cmdbuf, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 0, nullptr, 1, &before, 0, nullptr);
+        vkCmdUpdateBuffer(cmdbuf, *cubeFaceBuffer, 0, size, faces);
+        vkCmdPipelineBarrier(cmdbuf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                             0, 0, nullptr, 1, &after, 0, nullptr);
+    }
+
+    scheduleShadowFaces(firstNewMap);
+    for (int l = 0; l < lights.size(); ++l) {
+        LightData& light = lights[l];
+        auto&      state = shadowMapStates[l];
+        const uint8_t faces = scheduledFaces[l];
+        if (faces == 0) {
+            state.staleness = state.dirtyFaces != 0 ? state.staleness + 1 : 0;
+            continue;
+        }
+
+        const auto draw_layer = [&](const TextureCubeShadowMap& texture, uint8_t layerFaces, bool load) {
+            if (texture.isLayered()) {
+                recordCubeLayered(cmdbuf, l, texture, load ? pipelines.shadowCubeLoadRenderPass : pipelines.shadowCubeRenderPass);
+                return;
+            }
+            const VkRect2D area = { { 0, 0 }, { texture.getWidth(), texture.getHeight() } };
+            for (int i = 0; i < 6; ++i) {
+                if (layerFaces & (1 << i)) {
+                    recordCubeFace(cmdbuf, l, i, load ? pipelines.shadowMapLoadRenderPass : pipelines.shadowMapRenderPass,
+                                   texture.getFramebuffer(i), area);
+                }
+            }
+        };
+
+        if (omni) {
+            // Always drawn whole, see updateShadowMapStates().
+            gatherShadowCasters(light, eShadowCasters_All);
+            for (uint32_t i = 0; i < omni_face_count(shadowMapConf.omni); ++i) {
+                recordOmniFace(cmdbuf, l, i);
+            }
+        } else if (shadowMapConf.atlas) {
+            // The atlas only has the one layer, no multiview and no static
+            // layer there. Each face clears just its own tile.
+            gatherShadowCasters(light, eShadowCasters_All);
+            for (int i = 0; i < 6; ++i) {
+                if (faces & (1 << i)) {
+                    const auto&    tile = state.tiles[i];
+                    const VkRect2D area = { { int32_t(tile.x), int32_t(tile.y) }, { tile.size, tile.size } };
+                    recordCubeFace(cmdbuf, l, i, pipelines.shadowMapLoadRenderPass, shadowAtlasTexture->getFramebuffer(), area, true);
+                }
+            }
+        } else if (!shadowMapConf.staticLayer) {
+            gatherShadowCasters(light, eShadowCasters_All);
+            draw_layer(shadowMaps[l], faces, false);
+        } else {
+            // Static casters only get redrawn with the light, the rest go
+            // over a copy of them.
+            const auto& staticMap = staticShadowMaps[l];
+            const uint8_t staticFaces = state.dirtyStaticFaces & faces;
+            if (staticFaces != 0) {
+                gatherShadowCasters(light, eShadowCasters_Static);
+                draw_layer(staticMap, staticMap.isLayered() ? ShadowMapState::ALL_FACES : staticFaces, false);
+            }
+            copy_cube_faces(cmdbuf, staticMap, shadowMaps[l], faces);
+            gatherShadowCasters(light, eShadowCasters_Dynamic);
+            draw_layer(shadowMaps[l], faces, true);
+        }
+        state.dirtyFaces       &= ~faces;
+        state.dirtyStaticFaces &= ~faces;
+        state.fresh     = false;
+        state.staleness = state.dirtyFaces != 0 ? state.staleness + 1 : 0;
+    }
+
+    if (omni) {
+        const VkExtent2D extent = omni_map_extent(shadowMapConf.omni, shadowMapConf.resolution);
+        const glm::vec2  size   = { float(extent.width), float(extent.height) };
+        for (int l = 0; l < lights.size(); ++l) {
+            lights[l].shadowMap     = set.addImageView(omniShadowMaps[l]->getView());
+            lights[l].shadowAtlas   = 0;
+            lights[l].omniShadowMap = shadowMapConf.omni;
+            for (uint32_t i = 0; i < omni_face_count(shadowMapConf.omni); ++i) {
+                const VkRect2D area = omni_face_area(i, shadowMapConf.resolution);
+                lights[l].atlasRects[i] = glm::vec4(glm::vec2(area.extent.width, area.extent.height) / size,
+                                                    glm::vec2(area.offset.x, area.offset.y) / size);
+            }
+        }
+        return;
+    }
+    if (shadowMapConf.atlas) {
+        const uint32_t atlasView = set.addImageView(shadowAtlasTexture->getView());
+        const float    atlasSize = float(shadowAtlas.getSize());
+        for (int l = 0; l < lights.size(); ++l) {
+            lights[l].shadowMap     = atlasView;
+            lights[l].shadowAtlas   = 1;
+            lights[l].omniShadowMap = eOmniShadowMap_Cube;
+            for (int i = 0; i < 6; ++i) {
+                const auto& tile = shadowMapStates[l].tiles[i];
+                lights[l].atlasRects[i] = glm::vec4(tile.size, tile.size, tile.x, tile.y) / atlasSize;
+            }
+        }
+        drawStats.atlasUsage = float(shadowAtlas.getUsedArea()) / (atlasSize * atlasSize);
+        return;
+    }
+    for (int l = 0; l < lights.size(); ++l) {
+        lights[l].shadowMap     = set.addImageView(shadowMaps[l].getView());
+        lights[l].shadowAtlas   = 0;
+        lights[l].omniShadowMap = eOmniShadowMap_Cube;
+    }
+}
+
+void Scene::gatherShadowCasters(const LightData& light, eShadowCasters casters) {
+    shadowCasters.clear();
+    shadowCasterLayer = casters;
+    for (auto i : nodeDrawOrder) {
+        if (casters != eShadowCasters_All && nodes[i].dynamic != (casters == eShadowCasters_Dynamic)) {
+            continue;
+        }
+        // Only what's in range can cast a shadow.
+        const auto& mesh = meshes[gltfModel.nodes[i].mesh];
+        if (!frustumCulling || !mesh.hasBounds || nodes[i].bounds.intersectsSphere(light.position, light.range)) {
+            shadowCasters.push_back(i);
+        }
+    }
+}
+
+void Scene::updateShadowMapStates(size_t firstNewMap) {
+    constexpr uint8_t ALL_FACES = ShadowMapState::ALL_FACES;
+    shadowMapStates.resize(firstNewMap);
+    shadowMapStates.resize(lights.size(), { .dirtyFaces = ALL_FACES, .dirtyStaticFaces = ALL_FACES, .fresh = true });
+
+    for (uint32_t l = 0; l < lights.size(); ++l) {
+        const auto& light = lights[l];
+        auto& state = shadowMapStates[l];
+        if (!shadowMapCaching || state.position != light.position || state.range != light.range || state.conf != shadowMapConf) {
+            state.dirtyFaces       = ALL_FACES;
+            state.dirtyStaticFaces = ALL_FACES;
+        }
+        state.position = light.position;
+        state.range    = light.range;
+        state.conf     = shadowMapConf;
+        if (state.dirtyFaces == ALL_FACES) {
+            continue;
+        }
+
+        // Anything that moved in or out of a face needs it redrawn. Only
+        // dynamic nodes move, the static layer stays as it is.
+        const glm::mat4 projection = cube_face_projection(light);
+        for (int i = 0; i < 6; ++i) {
+            Frustum face(projection * cube_face_view(i, light.position));
+            for (const auto& bounds : movedBounds) {
+                if (bounds.intersectsSphere(light.position, light.range) && face.intersects(bounds)) {
+                    state.dirtyFaces |= 1 << i;
+                    break;
+                }
+            }
+        }
+        // The other layouts' faces don't line up with the cube's, those
+        // get redrawn whole.
+        if (shadowMapConf.omni != eOmniShadowMap_Cube && state.dirtyFaces != 0) {
+            state.dirtyFaces = ALL_FACES;
+        }
+    }
+    movedBounds.clear();
+}
+
+void Scene::skipShadowMaps() {
+    // Nothing keeps track of what moves meanwhile, so the maps start over
+    // once they're drawn again.
+    movedBounds.clear();
+    for (auto& state : shadowMapStates) {
+        state.dirtyFaces       = ShadowMapState::ALL_FACES;
+        state.dirtyStaticFaces = ShadowMapState::ALL_FACES;
+        state.fresh            = true;
+    }
+}
+
+/// Radius of the light's range on screen in pixels, FLT_MAX with the
+/// camera inside of it.
+static float screen_radius(const Scene::CameraData& camera, const Scene::LightData& light, uint32_t screenHeight) {
+    const float distance = glm::distance(camera.eye, light.position);
+    if (distance <= light.range) {
+        return FLT_MAX;
+    }
+    const float tanRadius = light.range / std::sqrt(distance * distance - light.range * light.range);
+    return tanRadius * std::abs(camera.projection[1][1]) * 0.5f * float(screenHeight);
+}
+
+/// Atlas tile size for the faces of a light, about as many texels as the
+/// radius of its range has pixels on screen. `current` is the size it has
+/// now, it only shrinks once well below that to avoid flipping sizes.
+static uint32_t atlas_tile_size(const Scene::CameraData& camera, const Scene::LightData& light, uint32_t screenHeight,
+                                uint32_t maxSize, uint32_t current) {
+    const float radius = std::min(screen_radius(camera, light, screenHeight), float(maxSize));
+    uint32_t size = std::bit_ceil(uint32_t(radius) + 1);
+    if (size < current && radius > current * 0.375f) {
+        size = current;
+    }
+    return std::clamp(size, ShadowAtlas::MIN_TILE_SIZE, maxSize);
+}
+
+void Scene::updateAtlasTiles() {
+    const uint32_t maxSize = std::clamp(std::bit_floor(shadowMapConf.resolution), ShadowAtlas::MIN_TILE_SIZE, shadowAtlas.getSize() / 4);
+    std::vector<uint32_t> sizes(lights.size());
+    uint64_t area = 0;
+    for (uint32_t l = 0; l < lights.size(); ++l) {
+        sizes[l] = atlas_tile_size(camera, lights[l], renderer.getSwapchain().getHeight(), maxSize, shadowMapStates[l].tiles[0].size);
+        area += 6 * uint64_t(sizes[l]) * sizes[l];
+    }
+    // Over the budget, halve the largest tiles until everything fits.
+    const uint64_t atlasArea = uint64_t(shadowAtlas.getSize()) * shadowAtlas.getSize();
+    while (area > atlasArea) {
+        auto largest = std::max_element(sizes.begin(), sizes.end());
+        if (*largest <= ShadowAtlas::MIN_TILE_SIZE) {
+            break; // Can't happen with up to MAX_LIGHTS lights.
+        }
+        area -= 6 * uint64_t(*largest) * *largest * 3 / 4;
+        *largest /= 2;
+    }
+
+    // Only lights whose size changed move to new tiles, the others keep
+    // theirs along with the contents.
+    std::vector<uint32_t> moved;
+    for (uint32_t l = 0; l < lights.size(); ++l) {
+        auto& state = shadowMapStates[l];
+        if (state.tiles[0].size == sizes[l]) {
+            continue;
+        }
+        for (auto& tile : state.tiles) {
+            shadowAtlas.free(tile);
+            tile = {};
+        }
+        moved.push_back(l);
+    }
+    // Largest first, so that small tiles don't split up the space first.
+    const auto by_size = [&](uint32_t a, uint32_t b) { return sizes[a] > sizes[b]; };
+    std::sort(moved.begin(), moved.end(), by_size);
+
+    bool packed = true;
+    for (auto l : moved) {
+        for (auto& tile : shadowMapStates[l].tiles) {
+            packed = packed && shadowAtlas.allocate(sizes[l], tile);
+        }
+    }
+    if (!packed) {
+        // Too fragmented, start over. That always fits since the area does.
+        shadowAtlas.reset(shadowAtlas.getSize());
+        moved.resize(lights.size());
+        for (uint32_t l = 0; l < lights.size(); ++l) {
+            moved[l] = l;
+        }
+        std::sort(moved.begin(), moved.end(), by_size);
+        for (auto l : moved) {
+            for (auto& tile : shadowMapStates[l].tiles) {
+                tile = {};
+                shadowAtlas.allocate(sizes[l], tile);
+            }
+        }
+    }
+    for (auto l : moved) {
+        shadowMapStates[l].dirtyFaces       = ShadowMapState::ALL_FACES;
+        shadowMapStates[l].dirtyStaticFaces = ShadowMapState::ALL_FACES;
+        shadowMapStates[l].fresh            = true;
+    }
+}
+
+bool Scene::isDrawnWhole(uint32_t lightID) const {
+    if (shadowMapConf.omni != eOmniShadowMap_Cube) {
+        return true;
+    }
+    return !shadowMapConf.atlas && shadowMaps[lightID].isLayered();
+}
+
+void Scene::scheduleShadowFaces(size_t firstNewMap) {
+    scheduledFaces.assign(lights.size(), 0);
+
+    uint32_t used = 0;
+    std::vector<uint32_t> waiting;
+    std::vector<float>    priorities(lights.size(), 0.0f);
+    for (uint32_t l = 0; l < lights.size(); ++l) {
+        const LightData& light = lights[l];
+        const auto&      state = shadowMapStates[l];
+        if (state.dirtyFaces == 0) {
+            drawStats.cachedFaces += 6;
+            continue;
+        }
+        // Nothing visible is lit, the old contents won't be seen. The
+        // faces stay dirty until it is.
+        if (frustumCulling && l < firstNewMap && !isLightVisible(light)) {
+            drawStats.skippedLights++;
+            continue;
+        }
+        const bool    layered = isDrawnWhole(l);
+        const uint8_t dirty   = layered ? ShadowMapState::ALL_FACES : state.dirtyFaces;
+        drawStats.cachedFaces += 6 - std::popcount(dirty);
+
+        // Never drawn ones have nothing to show in the meantime.
+        if (shadowFaceBudget == 0 || state.fresh) {
+            scheduledFaces[l] = dirty;
+            used += std::popcount(dirty);
+            continue;
+        }
+        // Brighter and larger on screen is more important, and the longer
+        // a light waits the more important it gets.
+        const float radius = std::min(screen_radius(camera, light, renderer.getSwapchain().getHeight()),
+                                      float(renderer.getSwapchain().getHeight()));
+        priorities[l] = light.intensity * radius * float(state.staleness + 1);
+        waiting.push_back(l);
+    }
+    std::sort(waiting.begin(), waiting.end(), [&](uint32_t a, uint32_t b) { return priorities[a] > priorities[b]; });
+
+    for (auto l : waiting) {
+        auto& state = shadowMapStates[l];
+        const bool layered = isDrawnWhole(l);
+        const uint8_t dirty = layered ? ShadowMapState::ALL_FACES : state.dirtyFaces;
+        uint32_t left = used < shadowFaceBudget ? shadowFaceBudget - used : 0;
+
+        uint8_t faces = 0;
+        if (layered) {
+            // With a budget below six it'd never fit, so the first one in
+            // line gets drawn anyway.
+            if (left >= 6 || used == 0) {
+                faces = dirty;
+            }
+        } else {
+            // Round-robin over the faces, continuing where the last
+            // frame stopped.
+            for (uint32_t k = 0; k < 6 && left > 0; ++k) {
+                const uint32_t i = (state.nextFace + k) % 6;
+                if (dirty & (1 << i)) {
+                    faces |= 1 << i;
+                    left--;
+                    state.nextFace = (i + 1) % 6;
+                }
+            }
+        }
+        scheduledFaces[l] = faces;
+        used += std::popcount(faces);
+        drawStats.deferredFaces += std::popcount(uint8_t(dirty & ~faces));
+    }
+}
+
+void Scene::recordCubeFace(VkCommandBuffer cmdbuf, int lightID, int faceID, VkRenderPass renderPass, VkFramebuffer framebuffer,
+                           const VkRect2D& area, bool clearArea) {
+    LightData& light = lights[lightID];
+
+    CameraData lcam;
+    lcam.projection = cube_face_projection(light);
+    lcam.view       = cube_face_view(faceID, light.position);
+    lcam.projView   = lcam.projection * lcam.view;
+    recordShadowCameraUpdate(cmdbuf, lcam);
+
+    if (indirectDraws && gpuCulling) {
+        recordCullDispatch(cmdbuf, eSceneDrawType_ShadowMap, CULL_VIEW_SHADOW, glm::vec4(0.0f), shadowCasterLayer);
+    }
+
+    beginShadowMapPass(cmdbuf, renderPass, framebuffer, area, clearArea);
+
+    const Frustum frustum(lcam.projView);
+    std::fill(nodeVisible.begin(), nodeVisible.end(), false);
+    for (auto i : shadowCasters) {
+        const auto& mesh = meshes[gltfModel.nodes[i].mesh];
+        nodeVisible[i] = !frustumCulling || !mesh.hasBounds || frustum.intersects(nodes[i].bounds);
+    }
+    recordDrawPackets(cmdbuf, eSceneDrawType_ShadowMap, eScenePipelineFlags_Depth, drawStats.shadowDrawn, drawStats.shadowCulled,
+                      drawStats.shadowTriangles);
+
+    vkCmdEndRenderPass(cmdbuf);
+}
+
+void Scene::recordOmniFace(VkCommandBuffer cmdbuf, int lightID, int faceID) {
+    const LightData& light      = lights[lightID];
+    const bool       paraboloid = shadowMapConf.omni == eOmniShadowMap_DualParaboloid;
+
+    // The paraboloid projection is done in the vertex shader, with the
+    // light's depth range from the camera.
+    CameraData lcam;
+    lcam.depthNear = light.zNear;
+    lcam.depthFar  = light.zFar;
+    if (paraboloid) {
+        lcam.projection = glm::mat4(1.0f);
+        lcam.view       = paraboloid_view(faceID, light.position);
+    } else {
+        lcam.projection = tetrahedron_face_projection(light);
+        lcam.view       = tetrahedron_face_view(faceID, light.position);
+    }
     lcam.projView = lcam.projection * lcam.view;
+    recordShadowCameraUpdate(cmdbuf, lcam);
+
+    // A half isn't a frustum, on the GPU it's only culled against the
+    // light's range like the layered cubes.
+    if (indirectDraws && gpuCulling) {
+        const glm::vec4 sphere = paraboloid ? glm::vec4(light.position, light.range) : glm::vec4(0.0f);
+        recordCullDispatch(cmdbuf, eSceneDrawType_ShadowMap, CULL_VIEW_SHADOW, sphere, shadowCasterLayer);
+    }
+
+    beginShadowMapPass(cmdbuf, pipelines.shadowMapLoadRenderPass, omniShadowMaps[lightID]->getFramebuffer(),
+                       omni_face_area(faceID, shadowMapConf.resolution), true);
+
+    const Frustum frustum(lcam.projView);
+    std::fill(nodeVisible.begin(), nodeVisible.end(), false);
+    for (auto i : shadowCasters) {
+        const auto& mesh   = meshes[gltfModel.nodes[i].mesh];
+        const auto& bounds = nodes[i].bounds;
+        bool visible = !frustumCulling || !mesh.hasBounds;
+        if (!visible && paraboloid) {
+            // Each half only sees its side of the light.
+            visible = faceID == 0 ? bounds.min.z <= light.position.z : bounds.max.z >= light.position.z;
+        } else if (!visible) {
+            visible = frustum.intersects(bounds);
+        }
+        nodeVisible[i] = visible;
+    }
+    recordDrawPackets(cmdbuf, eSceneDrawType_ShadowMap, eScenePipelineFlags_Depth, drawStats.shadowDrawn, drawStats.shadowCulled,
+                      drawStats.shadowTriangles, paraboloid ? pipelines.shadowParaboloid : nullptr);
+
+    vkCmdEndRenderPass(cmdbuf);
+}
+
+void Scene::recordCubeLayered(VkCommandBuffer cmdbuf, int lightID, const TextureCubeShadowMap& texture, VkRenderPass renderPass) {
+    const LightData& light = lights[lightID];
+
+    // A draw goes to all faces, so the casters can only be culled
+    // against the light's range.
+    if (indirectDraws && gpuCulling) {
+        recordCullDispatch(cmdbuf, eSceneDrawType_ShadowMap, CULL_VIEW_SHADOW, glm::vec4(light.position, light.range), shadowCasterLayer);
+    }
+
+    const VkRect2D area = { { 0, 0 }, { texture.getWidth(), texture.getHeight() } };
+    beginShadowMapPass(cmdbuf, renderPass, texture.getLayeredFramebuffer(), area);
+
+    std::fill(nodeVisible.begin(), nodeVisible.end(), false);
+    for (auto i : shadowCasters) {
+        nodeVisible[i] = true;
+    }
+    pushConstants.currentLightID = lightID; // Picks the face matrices.
+    recordDrawPackets(cmdbuf, eSceneDrawType_ShadowMap, eScenePipelineFlags_Depth, drawStats.shadowDrawn, drawStats.shadowCulled,
+                      drawStats.shadowTriangles, pipelines.shadowCube);
 
+    vkCmdEndRenderPass(cmdbuf);
+}
+
+void Scene::recordShadowCameraUpdate(VkCommandBuffer cmdbuf, const CameraData& lcam) {
     VkBufferMemoryBarrier bsbarrier = cameraBuffer->getBarrier(VK_ACCESS_SHADER_READ_BIT,
                                                                VK_ACCESS_TRANSFER_WRITE_BIT,
                                                                0, sizeof(lcam));
@@ -329,51 +1359,73 @@ void Scene::recordCubeFace(VkCommandBuffer cmdbuf, int lightID, int faceID) {
                                                                VK_ACCESS_SHADER_READ_BIT,
                                                                0, sizeof(lcam));
     vkCmdPipelineBarrier(cmdbuf,
-                         VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                         VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
                          VK_PIPELINE_STAGE_TRANSFER_BIT,
                          0, 0, nullptr, 1, &bsbarrier, 0, nullptr);
     vkCmdUpdateBuffer(cmdbuf, *cameraBuffer, 0, sizeof(lcam), &lcam);
     vkCmdPipelineBarrier(cmdbuf,
                          VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                         VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
                          0, 0, nullptr, 1, &bdbarrier, 0, nullptr);
-    
+}
+
+void Scene::beginShadowMapPass(VkCommandBuffer cmdbuf, VkRenderPass renderPass, VkFramebuffer framebuffer, const VkRect2D& area, bool clearArea) {
     VkClearValue clearValue;
     clearValue.depthStencil = { 1.0f, 0 };
 
-    const auto& texture = shadowMaps[lightID];
-
     VkRenderPassBeginInfo brp = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
-    brp.renderPass        = pipelines.shadowMapRenderPass;
-    brp.framebuffer       = texture.getFramebuffer(faceID);
-    brp.renderArea.offset = {0, 0};
-    brp.renderArea.extent = {texture.getWidth(), texture.getHeight()};
+    brp.renderPass        = renderPass;
+    brp.framebuffer       = framebuffer;
+    brp.renderArea        = area;
     brp.clearValueCount   = 1;
     brp.pClearValues      = &clearValue;
     vkCmdBeginRenderPass(cmdbuf, &brp, VK_SUBPASS_CONTENTS_INLINE);
+    drawStats.shadowPasses++;
+
+    if (clearArea) {
+        VkClearAttachment attachment = {};
+        attachment.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+        attachment.clearValue = clearValue;
+        VkClearRect rect = {};
+        rect.rect       = area;
+        rect.layerCount = 1;
+        vkCmdClearAttachments(cmdbuf, 1, &attachment, 1, &rect);
+    }
 
     VkViewport viewport = {};
-    viewport.x        = 0.0f;
-    viewport.y        = 0.0f;
-    viewport.width    = texture.getWidth();
-    viewport.height   = texture.getHeight();
+    viewport.x        = float(area.offset.x);
+    viewport.y        = float(area.offset.y);
+    viewport.width    = float(area.extent.width);
+    viewport.height   = float(area.extent.height);
     viewport.minDepth = 0.0f;
     viewport.maxDepth = 1.0f;
     vkCmdSetViewport(cmdbuf, 0, 1, &viewport);
-
-    VkRect2D scissor = {};
-    scissor.offset = {0, 0};
-    scissor.extent = brp.renderArea.extent;
-    vkCmdSetScissor(cmdbuf, 0, 1, &scissor);
+    vkCmdSetScissor(cmdbuf, 0, 1, &area);
     vkCmdSetDepthBias(cmdbuf, shadowMapConf.biasConstant, 0.0f, shadowMapConf.biasSlope);
 
     lastBoundPipeline = VK_NULL_HANDLE;
+    geometry.bindPositionBuffer(cmdbuf, 0);
+    geometry.bindVertexBuffer(cmdbuf, 1); // Texcoords, only read by the alpha tested pipelines.
+    boundIndexType = VK_INDEX_TYPE_MAX_ENUM;
+}
+
+bool Scene::isLightVisible(const LightData& light) const {
+    const Frustum frustum(camera.projView);
+    if (!frustum.intersectsSphere(light.position, light.range)) {
+        return false;
+    }
+    // Some receiver the camera sees has to be in range as well.
     for (auto i : nodeDrawOrder) {
-        pushConstants.transform = nodes[i].globalTransform;
-        recordMeshDraw(cmdbuf, gltfModel.nodes[i].mesh, eScenePipelineFlags_Depth, eSceneDrawType_ShadowMap);
+        const auto& mesh = meshes[gltfModel.nodes[i].mesh];
+        if (!mesh.hasBounds) {
+            return true;
+        }
+        const Aabb& bounds = nodes[i].bounds;
+        if (frustum.intersects(bounds) && bounds.intersectsSphere(light.position, light.range)) {
+            return true;
+        }
     }
-
-    vkCmdEndRenderPass(cmdbuf);
+    return false;
 }
 
 void Scene::allocateBuffers() {
@@ -389,16 +1441,183 @@ void Scene::allocateBuffers() {
         renderer,
         sizeof(CameraData)
     );
+    cubeFaceBuffer = std::make_unique<GpuShaderBuffer>(
+        renderer,
+        sizeof(glm::mat4) * 6 * MAX_LIGHTS
+    );
+    pushConstants.cubeFaces = cubeFaceBuffer->getGpuAddress();
+    nodeBuffer = std::make_unique<GpuShaderBuffer>(
+        renderer,
+        sizeof(NodeData) * std::max<size_t>(gltfModel.nodes.size(), 1)
+    );
+    pushConstants.nodes = nodeBuffer->getGpuAddress();
 }
 
-void Scene::loadMeshes() {
-    for (const auto& gltfMesh : gltfModel.meshes) {
-        VIBufferBuilder builder(renderer, gltfModel, gltfMesh);
-        auto& mesh = meshes.emplace_back(
-            builder.create(),
-            std::move(builder.groups)
-        );
+void Scene::loadMeshes(const std::string& filename) {
+    using clock = std::chrono::steady_clock;
+    using ms    = std::chrono::duration<double, std::milli>;
+
+    const uint32_t meshCount = uint32_t(gltfModel.meshes.size());
+    WorkerPool& pool = WorkerPool::get();
+
+    // Reuse the output of an earlier run if the model and options didn't change.
+    auto t0 = clock::now();
+    const std::string cachePath = filename + ".geomcache";
+    GeometryCache cache;
+    uint64_t      cacheKey = 0;
+    bool          cached   = false;
+    if (meshConf.geometryCache) {
+        cacheKey = GeometryCache::computeKey(gltfModel, meshConf);
+        cached   = cache.open(cachePath, cacheKey, meshCount, geometry.getVertexStride());
+    }
+
+    std::vector<std::unique_ptr<VIBufferBuilder>> builders;
+    if (!cached) {
+        // Start with the largest meshes so that one big mesh doesn't end up
+        // being built alone at the very end.
+        std::vector<uint32_t> order(meshCount);
+        std::vector<size_t>   weights(meshCount, 0);
+        for (uint32_t m = 0; m < meshCount; ++m) {
+            order[m] = m;
+            for (const auto& gltfGroup : gltfModel.meshes[m].primitives) {
+                if (gltfGroup.indices >= 0) {
+                    weights[m] += gltfModel.accessors[gltfGroup.indices].count;
+                }
+            }
+        }
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return weights[a] > weights[b]; });
+
+        builders.resize(meshCount);
+        pool.run(meshCount, [&](uint32_t i) {
+            uint32_t m = order[i];
+            builders[m] = std::make_unique<VIBufferBuilder>(gltfModel, gltfModel.meshes[m], meshConf);
+        });
+        for (const auto& builder : builders) {
+            std::cout << builder->getLog();
+        }
+
+        if (meshConf.geometryCache && !GeometryCache::write(cachePath, cacheKey, builders)) {
+            std::cout << std::format("Couldn't write the geometry cache {}.\n", cachePath);
+        }
+    }
+    auto t1 = clock::now();
+
+    const auto vertex_bytes = [&](uint32_t m) { return cached ? cache.getMesh(m).vertexBytes : builders[m]->getVertexDataSize(); };
+    const auto index_bytes  = [&](uint32_t m) { return cached ? cache.getMesh(m).indexBytes  : builders[m]->getIndexDataSize(); };
+    const auto edge_bytes   = [&](uint32_t m) { return cached ? cache.getMesh(m).edgeBytes   : builders[m]->getEdgeDataSize(); };
+    const auto buffer_size  = [&](uint32_t m) { return cached ? cache.getMesh(m).getBufferSize() : uint64_t(builders[m]->getBufferSize()); };
+
+    // Place all meshes in the arena at once so it grows at most once.
+    uint64_t vertexBytes = 0;
+    uint64_t indexBytes  = 0;
+    uint64_t edgeBytes   = 0;
+    for (uint32_t m = 0; m < meshCount; ++m) {
+        vertexBytes += vertex_bytes(m);
+        indexBytes  += index_bytes(m);
+        edgeBytes   += edge_bytes(m);
+    }
+    geometry.reserve(vertexBytes, indexBytes, edgeBytes);
+
+    meshes.reserve(meshCount);
+    for (uint32_t m = 0; m < meshCount; ++m) {
+        GeometryArena::Handle handle = geometry.allocate(vertex_bytes(m), index_bytes(m), edge_bytes(m));
+        if (cached) {
+            const auto& entry = cache.getMesh(m);
+            meshes.emplace_back(handle,
+                                GeometryArena::Allocation{},
+                                std::vector<VIBPrimGroup>(entry.groups, entry.groups + entry.groupCount),
+                                entry.dequantize);
+        } else {
+            meshes.emplace_back(handle,
+                                GeometryArena::Allocation{},
+                                std::move(builders[m]->groups),
+                                builders[m]->getDequantizeTransform());
+        }
+        auto& mesh = meshes.back();
+        mesh.placement = geometry.get(handle);
+        rebase_groups(mesh.primGroups, GeometryArena::Allocation{}, mesh.placement);
+
+        for (auto& group : mesh.primGroups) {
+            group.firstMeshlet += uint32_t(meshlets.size());
+        }
+        if (cached) {
+            const auto& entry = cache.getMesh(m);
+            meshlets.insert(meshlets.end(), entry.meshlets, entry.meshlets + entry.meshletCount);
+        } else {
+            meshlets.insert(meshlets.end(), builders[m]->meshlets.begin(), builders[m]->meshlets.end());
+        }
+        calcMeshBounds(m);
+    }
+
+    // Upload through shared staging buffers, one submission per batch.
+    uint64_t totalSize   = 0;
+    uint32_t submissions = 0;
+    for (uint32_t first = 0; first < meshCount;) {
+        uint64_t batchSize = 0;
+        uint32_t last      = first;
+        while (last < meshCount) {
+            uint64_t size = buffer_size(last);
+            if (last != first && batchSize + size > MAX_UPLOAD_BATCH_SIZE) {
+                break;
+            }
+            batchSize += size;
+            last++;
+        }
+
+        std::vector<uint64_t> offsets(last - first + 1, 0);
+        for (uint32_t m = first; m < last; ++m) {
+            offsets[m - first + 1] = offsets[m - first] + buffer_size(m);
+        }
+
+        GpuStagingBuffer staging(renderer, std::max<uint64_t>(batchSize, 1));
+        uint8_t* mapped = reinterpret_cast<uint8_t*>(staging.getMappedData());
+        pool.run(last - first, [&](uint32_t i) {
+            uint32_t m = first + i;
+            if (cached) {
+                memcpy(mapped + offsets[i], cache.getMesh(m).data, size_t(buffer_size(m)));
+            } else {
+                builders[m]->writeBufferData(mapped + offsets[i]);
+            }
+        });
+
+        renderer.recordOneTime([&](VkCommandBuffer cmdbuf) {
+            for (uint32_t m = first; m < last; ++m) {
+                geometry.recordUpload(cmdbuf, staging, offsets[m - first], meshes[m].geometry);
+            }
+        });
+        for (uint32_t m = first; m < last && !cached; ++m) {
+            builders[m].reset();
+        }
+
+        totalSize += batchSize;
+        submissions++;
+        first = last;
     }
+
+    // Meshlet bounds go to their own buffer, read through its address.
+    meshletBuffer = std::make_unique<GpuShaderBuffer>(renderer, sizeof(MeshletData) * std::max<size_t>(meshlets.size(), 1));
+    if (!meshlets.empty()) {
+        GpuStagingBuffer staging(renderer, sizeof(MeshletData) * meshlets.size());
+        memcpy(staging.getMappedData(), meshlets.data(), staging.getSize());
+        renderer.recordOneTime([&](VkCommandBuffer cmdbuf){
+            meshletBuffer->copyFrom(cmdbuf, staging, staging.getSize(), 0);
+        });
+    }
+    pushConstants.meshlets = meshletBuffer->getGpuAddress();
+    auto t2 = clock::now();
+
+    std::cout << std::format("Meshes: {} {} in {:.1f} ms on {} threads, {:.1f} MiB uploaded in {:.1f} ms with {} submissions.\n",
+                             meshCount,
+                             cached ? "loaded from cache" : "built",
+                             ms(t1 - t0).count(),
+                             pool.getThreadCount(),
+                             totalSize / (1024.0 * 1024.0),
+                             ms(t2 - t1).count(),
+                             submissions);
+    std::cout << std::format("Geometry arena: {:.1f} MiB used of {:.1f} MiB.\n",
+                             geometry.getUsedSize()     / (1024.0 * 1024.0),
+                             geometry.getCapacitySize() / (1024.0 * 1024.0));
+    std::cout << std::format("Meshlets: {}.\n", meshlets.size());
 }
 
 static const unsigned char placeholder_texture[] = {
@@ -533,6 +1752,35 @@ glm::mat4 Scene::getNodeTransform(int nodeID) {
     return nodes[nodeID].globalTransform;
 }
 
+glm::mat4 Scene::getDrawTransform(int nodeID) const {
+    return nodes[nodeID].globalTransform * meshes[gltfModel.nodes[nodeID].mesh].dequantize;
+}
+
+void Scene::calcMeshBounds(int meshID) {
+    auto& mesh = meshes[meshID];
+    mesh.bounds    = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+    mesh.hasBounds = true;
+    for (const auto& gltfGroup : gltfModel.meshes[meshID].primitives) {
+        auto it = gltfGroup.attributes.find("POSITION");
+        if (it == gltfGroup.attributes.end()) {
+            continue;
+        }
+        const auto& accessor = gltfModel.accessors[it->second];
+        if (accessor.minValues.size() != 3 || accessor.maxValues.size() != 3) {
+            mesh.hasBounds = false; // Optional in glTF.
+            return;
+        }
+        for (int c = 0; c < 3; ++c) {
+            mesh.bounds.min[c] = std::min(mesh.bounds.min[c], float(accessor.minValues[c]));
+            mesh.bounds.max[c] = std::max(mesh.bounds.max[c], float(accessor.maxValues[c]));
+        }
+    }
+    // No positions at all, nothing gets drawn anyway.
+    if (mesh.bounds.min.x > mesh.bounds.max.x) {
+        mesh.bounds = { glm::vec3(0.0f), glm::vec3(0.0f) };
+    }
+}
+
 void Scene::loadMaterials() {
     auto& defaultMaterial = materials.emplace_back();
     defaultMaterial.baseColorTID = 0;
@@ -580,6 +1828,7 @@ void Scene::calculateGlobalTransforms() {
             propagateTransform(glm::mat4(1.0), rootNodeID);
         }
     }
+    updateNodeData();
 }
 
 void Scene::propagateTransform(const glm::mat4& prev, int nodeID) {
@@ -587,7 +1836,23 @@ void Scene::propagateTransform(const glm::mat4& prev, int nodeID) {
     auto& nd = nodes[nodeID];
 
     nd.calculateLocalTransform();
+    const glm::mat4 oldTransform = nd.globalTransform;
     nd.globalTransform = prev * nd.localTransform;
+    if (node.mesh >= 0) {
+        const auto& mesh = meshes[node.mesh];
+        const Aabb oldBounds = nd.bounds;
+        nd.bounds = mesh.bounds.transformed(nd.globalTransform);
+
+        // Shadow maps need redrawing where the mesh was and where it is now.
+        if (nd.globalTransform != oldTransform) {
+            if (mesh.hasBounds) {
+                movedBounds.push_back(oldBounds);
+                movedBounds.push_back(nd.bounds);
+            } else {
+                movedBounds.push_back({ glm::vec3(-FLT_MAX), glm::vec3(FLT_MAX) });
+            }
+        }
+    }
     for (int child : node.children) {
         propagateTransform(nd.globalTransform, child);
     }
@@ -596,6 +1861,8 @@ void Scene::propagateTransform(const glm::mat4& prev, int nodeID) {
 void Scene::loadNodes() {
     nodeDrawOrder.clear();
     nodes.resize(gltfModel.nodes.size());
+    nodeData.assign(nodes.size(), { glm::mat4(1.0f), glm::vec4(0.0f), glm::vec4(0.0f) });
+    nodeVisible.assign(nodes.size(), false);
     for (int nodeID = 0; nodeID < nodes.size(); ++nodeID) {
         const auto& node = gltfModel.nodes[nodeID];
         auto& nd = nodes[nodeID];
@@ -647,12 +1914,60 @@ void Scene::loadNodes() {
         }
     }
     calculateGlobalTransforms();
+    movedBounds.clear(); // Every shadow map starts out dirty anyway.
+}
+
+void Scene::groupInstances() {
+    // Nodes sharing a mesh are drawn together, starting where the mesh
+    // first appears in the draw order.
+    std::vector<int> meshGroup(meshes.size(), -1);
+    meshInstances.clear();
+    for (auto i : nodeDrawOrder) {
+        const int meshID = gltfModel.nodes[i].mesh;
+        if (meshGroup[meshID] < 0) {
+            meshGroup[meshID] = int(meshInstances.size());
+            meshInstances.push_back({ meshID, 0, 0 });
+        }
+        meshInstances[meshGroup[meshID]].nodeCount++;
+    }
+    uint32_t firstNode = 0;
+    for (auto& instances : meshInstances) {
+        instances.firstNode = firstNode;
+        firstNode += instances.nodeCount;
+        instances.nodeCount = 0;
+    }
+    instanceNodes.resize(nodeDrawOrder.size());
+    for (auto i : nodeDrawOrder) {
+        auto& instances = meshInstances[meshGroup[gltfModel.nodes[i].mesh]];
+        instanceNodes[instances.firstNode + instances.nodeCount++] = i;
+    }
 }
 
 void Scene::loadAnimations() {
     for (int i = 0; i < gltfModel.animations.size(); i++) {
         animations.emplace_back(gltfModel, i);
     }
+
+    // Everything else never moves and can stay in the static shadow map layer.
+    for (auto& nd : nodes) {
+        nd.dynamic = false;
+    }
+    for (const auto& anim : animations) {
+        for (const auto& [nodeID, transform] : anim.nodes) {
+            markDynamic(nodeID);
+        }
+    }
+    updateNodeData(); // The flag is in the node data for GPU culling.
+}
+
+void Scene::markDynamic(int nodeID) {
+    if (nodes[nodeID].dynamic) {
+        return; // Children are done already.
+    }
+    nodes[nodeID].dynamic = true;
+    for (int child : gltfModel.nodes[nodeID].children) {
+        markDynamic(child);
+    }
 }
 
 void Scene::Node::calculateLocalTransform() {
@@ -13,9 +13,12 @@
 #include "Texture.hpp"
 #include "ScenePipelines.hpp"
 #include "VIBufferBuilder.hpp"
+#include "GeometryArena.hpp"
 #include "tiny_gltf_wrap.hpp"
 #include "Animation.hpp"
 #include "Configuration.hpp"
+#include "Frustum.hpp"
+#include "ShadowAtlas.hpp"
 
 enum eSceneDrawType {
     eSceneDrawType_Full,
@@ -26,8 +29,29 @@ enum eSceneDrawType {
     eSceneDrawTypeCount
 };
 
+/// Which nodes are drawn to a shadow map. Static ones are never moved by
+/// an animation and go to a cached layer that the dynamic ones are drawn
+/// on top of.
+enum eShadowCasters {
+    eShadowCasters_All,
+    eShadowCasters_Static,
+    eShadowCasters_Dynamic,
+};
+
+/// How the surroundings of a point light are laid out in its shadow map.
+enum eOmniShadowMap {
+    eOmniShadowMap_Cube,           // Six 90 degree faces, of a cube map or in atlas tiles.
+    eOmniShadowMap_DualParaboloid, // Two hemispheres side by side, one pass each.
+    eOmniShadowMap_Tetrahedral,    // Four wider faces in a 2x2 grid of one texture.
+};
+
 class Scene {
     static constexpr uint32_t MAX_LIGHTS = 32;
+    static constexpr uint64_t MAX_UPLOAD_BATCH_SIZE = 64 << 20; // Staging size limit for mesh uploads.
+    static constexpr uint32_t CULL_VIEW_CAMERA = 0; // The scene lists share one culled copy, they only differ in pipelines.
+    static constexpr uint32_t CULL_VIEW_SHADOW = 1; // Reused by every shadow map face.
+    static constexpr uint32_t CULL_VIEW_COUNT  = 2;
+    static constexpr uint32_t MIN_ATLAS_SIZE   = 1024; // Fits the smallest tiles of MAX_LIGHTS lights.
 public:
     struct alignas(16) LightData {
         glm::vec3 position;
@@ -38,6 +62,9 @@ public:
         uint32_t  shadowMap;
         float     zNear;
         float     zFar;
+        uint32_t  shadowAtlas;   // Non-zero if shadowMap is the atlas, with the faces at atlasRects.
+        uint32_t  omniShadowMap; // eOmniShadowMap, the faces of the other two are at atlasRects as well.
+        glm::vec4 atlasRects[6]; // Per face, scale (xy) and offset (zw) of the tile in atlas UVs.
     };
 
     struct alignas(16) MaterialData {
@@ -62,11 +89,30 @@ public:
         glm::mat4 projView;
     };
 
+    /// Per node data, uploaded whenever the global transforms change.
+    struct alignas(16) NodeData {
+        glm::mat4 transform; // Global transform with the dequantization of the mesh.
+        glm::vec4 boundsMin; // World space bounds for GPU culling,
+        glm::vec4 boundsMax; // w = 0 in boundsMin if it has none. w = 1 in boundsMax if it's dynamic.
+    };
+
+    /// Per draw data of the scene and shadow map passes, one for every
+    /// instance of a primitive group. Their shaders look up its index in
+    /// PushConstants::drawIndices with gl_InstanceIndex.
+    struct alignas(16) DrawData {
+        VkDeviceAddress material;
+        uint32_t        nodeID;
+        uint32_t        padding0;
+    };
+
     struct alignas(16) PushConstants {
-        glm::mat4       transform;
         VkDeviceAddress camera;
-        VkDeviceAddress material;
+        VkDeviceAddress nodes;
+        VkDeviceAddress draws;
+        VkDeviceAddress drawIndices; // Identity, or the visible instances from GPU culling.
+        VkDeviceAddress cubeFaces;   // Used only when drawing to multiview cube shadow maps
         VkDeviceAddress lights;
+        VkDeviceAddress meshlets;    // Of all meshes, see VIBPrimGroup::firstMeshlet.
         uint32_t        lightCount;
         uint32_t        textureBaseIndex;
         uint32_t        currentLightID; // Used only when rendering shadow volumes
@@ -83,11 +129,61 @@ public:
         glm::vec3 scale;
         glm::mat4 localTransform;
         glm::mat4 globalTransform;
+        Aabb      bounds;  // World space bounds of the mesh, if it has any.
+        bool      dynamic; // An animation moves it or one of its parents.
     };
     
     struct Mesh {
-        GpuVertexIndexBuffer      buffer;
-        std::vector<VIBPrimGroup> primGroups;
+        GeometryArena::Handle     geometry;
+        GeometryArena::Allocation placement;  // What the group offsets are based on.
+        std::vector<VIBPrimGroup> primGroups; // Offsets already include the placement.
+        glm::mat4                 dequantize; // Applied before the node transform.
+        Aabb                      bounds;     // From the POSITION accessors, before dequantization.
+        bool                      hasBounds;  // False if an accessor has no min/max, never culled then.
+    };
+
+    struct DrawStats {
+        uint32_t drawn;         // Draw calls recorded by recordScene(), before GPU culling.
+        uint32_t culled;        // Instances skipped because the node was outside the frustum, 0 with GPU culling.
+        uint32_t shadowDrawn;   // Same for the shadow map faces.
+        uint32_t shadowCulled;
+        uint32_t shadowPasses;  // Shadow map render passes, a multiview one counts once.
+        uint64_t triangles;     // Submitted by the scene draws, before GPU culling.
+        uint64_t shadowTriangles;
+        uint32_t skippedLights; // Lights whose shadow maps weren't updated.
+        uint32_t cachedFaces;   // Shadow map faces kept from an earlier frame.
+        uint32_t deferredFaces; // Changed faces left for a later frame by the face budget.
+        float    atlasUsage;    // Share of the shadow atlas taken by tiles.
+    };
+
+    /// Nodes that share a mesh, drawn as instances of it.
+    struct MeshInstances {
+        int      meshID;
+        uint32_t firstNode; // Into instanceNodes.
+        uint32_t nodeCount;
+    };
+
+    /// One instanced draw call with everything needed to record it,
+    /// baked at load.
+    struct DrawPacket {
+        uint32_t        flags;    // eScenePipelineFlags from the material, without the pass' base flags.
+        VkDeviceAddress material;
+        uint32_t        firstNode;     // Into instanceNodes.
+        uint32_t        instanceCount;
+        uint32_t        drawID;        // DrawData index of the first instance, the rest follow it.
+        VkIndexType     indexType;
+        uint32_t        indexCount;
+        uint32_t        firstIndex;
+        int32_t         vertexOffset;
+    };
+
+    /// Run of packets sharing the pipeline and index buffer binding,
+    /// drawn by a single vkCmdDrawIndexedIndirect.
+    struct DrawBucket {
+        uint32_t    flags;
+        VkIndexType indexType;
+        uint32_t    first;
+        uint32_t    count;
     };
 
     struct ShadowMapConf {
@@ -96,26 +192,55 @@ public:
         float    biasConstant;
         float    biasSlope;
         float    zNear;
+        bool     multiview;   // All six faces of a cube in one render pass.
+        bool     staticLayer; // Static casters only drawn to a cached cube, copied before the dynamic ones.
+        bool     atlas;       // Faces drawn to tiles of one shared texture, up to `resolution` large.
+        uint32_t atlasSize;   // Only read when the atlas is created.
+        eOmniShadowMap omni;  // Only cube maps are multiview, layered or in the atlas.
+
+        bool operator==(const ShadowMapConf&) const = default;
+    };
+
+    /// What a shadow map was last drawn with, see drawToShadowMaps().
+    struct ShadowMapState {
+        glm::vec3     position;
+        float         range;
+        ShadowMapConf conf;
+        uint8_t       dirtyFaces;       // Bit per cube face.
+        uint8_t       dirtyStaticFaces; // Same for the static layer, a subset of dirtyFaces.
+        ShadowAtlas::Tile tiles[6];     // Of the faces, in atlas mode.
+        bool          fresh;            // Nothing drawn yet, so the face budget doesn't apply.
+        uint8_t       nextFace;         // Where the budget continues with the dirty faces.
+        uint32_t      staleness;        // Frames the light has had dirty faces for.
+
+        static constexpr uint8_t ALL_FACES = 0x3F;
     };
 
-    Scene(Renderer& renderer, const ScenePipelines& pipelines, const std::string& filename);
+    Scene(Renderer& renderer, const ScenePipelines& pipelines, GeometryArena& geometry, const std::string& filename, const VIBConf& meshConf);
+
+    /// Returns the mesh geometry to the arena.
+    ~Scene();
+
+    /// Copying not allowed.
+    Scene(const Scene&) = delete;
+
+    /// Updates the draw offsets of all meshes after GeometryArena::compact().
+    void relocateGeometry();
 
     /// Does not fill out samplers.
     void fillOutBindlessSet(BindlessSet& set);
 
-    /// Records commands to draw a mesh into the command buffer.
-    /// Used inside recordDrawCommands();
-    void recordMeshDraw(VkCommandBuffer cmdbuf,
-                        int nodeID,
-                        uint32_t baseFlags = eScenePipelineFlags_Depth,
-                        eSceneDrawType drawType = eSceneDrawType_Full);
-
     /// Lit scene draw functions. Descriptor set is assumed to be bound,
     /// swapchain render pass is assumed to be started.
     void recordScene(VkCommandBuffer cmdbuf,
                      uint32_t baseFlags = eScenePipelineFlags_Depth,
                      eSceneDrawType drawType = eSceneDrawType_Full);
     
+    /// Culls the indirect draws of the scene passes against the camera
+    /// on the GPU, if enabled. Call outside of a render pass after
+    /// recordDrawBufferUpdates() and before recordScene().
+    void recordCulling(VkCommandBuffer cmdbuf);
+
     /// Draws the shadow volumes into the stencil buffer
     void recordShadowVolumesStencil(VkCommandBuffer cmdbuf, eSVMethod method, uint32_t lightID);
 
@@ -126,8 +251,23 @@ public:
     /// render pass. Descriptor set is assumed to be bound.
     void drawToShadowMaps(VkCommandBuffer cmdbuf, BindlessSet& set);
 
-    /// Used by drawToShadowMaps()
-    void recordCubeFace(VkCommandBuffer cmdbuf, int lightID, int faceID); 
+    /// To be called instead of drawToShadowMaps() on frames without shadow
+    /// maps. Drops the moved bounds and marks all maps out of date.
+    void skipShadowMaps();
+
+    /// Used by drawToShadowMaps(). Draws the nodes in shadowCasters to the
+    /// area of a framebuffer, see beginShadowMapPass().
+    void recordCubeFace(VkCommandBuffer cmdbuf, int lightID, int faceID, VkRenderPass renderPass, VkFramebuffer framebuffer,
+                        const VkRect2D& area, bool clearArea = false);
+
+    /// Same for all six faces of a layered shadow map at once, with
+    /// multiview. The face matrices have to be in cubeFaceBuffer.
+    void recordCubeLayered(VkCommandBuffer cmdbuf, int lightID, const TextureCubeShadowMap& texture, VkRenderPass renderPass);
+
+    /// Used by drawToShadowMaps(). Draws the nodes in shadowCasters to one
+    /// of the halves or faces of the light's dual-paraboloid or tetrahedral
+    /// shadow map.
+    void recordOmniFace(VkCommandBuffer cmdbuf, int lightID, int faceID);
 
     /// Records commands to upload camera/light data to the buffer.
     void recordDrawBufferUpdates(VkCommandBuffer cmdbuf);
@@ -144,6 +284,11 @@ public:
     /// Returns the final transform for a node.
     glm::mat4 getNodeTransform(int nodeID);
 
+    /// Frames the shadow map of a light has been out of date for.
+    uint32_t getShadowMapStaleness(uint32_t lightID) const {
+        return lightID < shadowMapStates.size() ? shadowMapStates[lightID].staleness : 0;
+    }
+
     /// Traverses the node tree and updates global transform matrices.
     void calculateGlobalTransforms();
 
@@ -153,18 +298,107 @@ public:
     CameraData camera;
     std::vector<LightData> lights;
     std::vector<TextureCubeShadowMap> shadowMaps;
+    bool      frustumCulling; // Skip nodes outside the camera or shadow map face frustum, on the CPU or GPU path.
+    bool      indirectDraws;  // One indirect draw per bucket instead of a draw per packet, needs gpuCulling.
+    bool      gpuCulling;     // Cull indirect draws in a compute pass, the CPU doesn't cull them.
+    bool      shadowMapCaching; // Only redraw shadow map faces when something in them changed.
+    uint32_t  shadowFaceBudget; // Dirty shadow map faces drawn per frame, 0 for no limit.
+    DrawStats drawStats;      // Accumulated until reset by the caller.
 private:
     void allocateBuffers();
-    void loadMeshes();
+    void loadMeshes(const std::string& filename);
     void loadMaterials();
+
+    /// Mesh space bounds from the POSITION accessors of the primitives.
+    void calcMeshBounds(int meshID);
     
+    /// Draws one of the index streams of every primitive group with the
+    /// currently bound pipeline, e.g. the triangles or one of the edge
+    /// streams, instanced over the nodes sharing the mesh. Binds the
+    /// index or edge buffer itself.
+    void recordIndexStream(VkCommandBuffer cmdbuf, bool edges, uint32_t VIBPrimGroup::* first, uint32_t VIBPrimGroup::* count);
+
+    /// Bakes the sorted packet list of a draw type along with its buckets
+    /// and indirect commands. Depends on the geometry placement and for
+    /// shadow maps on shadowMapConf.cullFrontFaces.
+    void buildDrawPackets(eSceneDrawType drawType);
+
+    /// Bakes all packet lists and uploads them with the draw data.
+    void buildAllDrawPackets();
+
+    /// Records an update of the indirect commands of a draw type, outside
+    /// of a render pass.
+    void recordDrawCommandsUpdate(VkCommandBuffer cmdbuf, eSceneDrawType drawType);
+
+    /// Records the instances of the packets of a draw type whose nodes
+    /// are marked in nodeVisible, one draw per run of consecutive visible
+    /// instances, only binding what changes between them. With
+    /// indirectDraws and gpuCulling, records the buckets instead and
+    /// leaves the culling to recordCullDispatch(). Vertex buffers are
+    /// assumed to be bound.
+    /// Counts the triangles of the draws to `triangles`.
+    /// `pipelineTable` replaces the pipelines of the draw type if given.
+    void recordDrawPackets(VkCommandBuffer cmdbuf, eSceneDrawType drawType, uint32_t baseFlags, uint32_t& drawn, uint32_t& culled,
+                           uint64_t& triangles, const VkPipeline* pipelineTable = nullptr);
+
+    /// Fills in nodeData from the global transforms.
+    void updateNodeData();
+
+    /// Records the culling compute pass for the commands of a draw type
+    /// against the current contents of the camera buffer. Results go to
+    /// one of the CULL_VIEW_* slots of culledCommands/drawCounts/
+    /// culledDrawIndices. A sphere with w > 0 (center, radius) is culled
+    /// against instead of the camera. Nodes not in `casters` are culled too.
+    void recordCullDispatch(VkCommandBuffer cmdbuf, eSceneDrawType drawType, uint32_t view,
+                            const glm::vec4& sphere = glm::vec4(0.0f), eShadowCasters casters = eShadowCasters_All);
+
+    /// Replaces the camera buffer contents with the view of a shadow map
+    /// face, outside of a render pass.
+    void recordShadowCameraUpdate(VkCommandBuffer cmdbuf, const CameraData& lcam);
+
+    /// Begins a shadow map render pass with the viewport, depth bias and
+    /// vertex buffers set up for drawing the casters to `area`. With
+    /// `clearArea`, the area is cleared even if the pass loads the attachment.
+    void beginShadowMapPass(VkCommandBuffer cmdbuf, VkRenderPass renderPass, VkFramebuffer framebuffer, const VkRect2D& area, bool clearArea = false);
+
+    /// False if nothing the camera sees is in range of the light.
+    bool isLightVisible(const LightData& light) const;
+
+    /// Fills shadowCasters with the nodes in range of the light.
+    void gatherShadowCasters(const LightData& light, eShadowCasters casters);
+
+    /// Marks the shadow map faces that need redrawing, those of the maps
+    /// from firstNewMap on, of moved lights and any a node moved in or out of.
+    void updateShadowMapStates(size_t firstNewMap);
+
+    /// Picks the tile size of each light from how large it is on screen
+    /// and moves the lights whose size changed to new tiles. Only if those
+    /// don't fit, the whole atlas gets repacked.
+    void updateAtlasTiles();
+
+    /// True if the light's shadow map can only be drawn all at once, if
+    /// it's layered or not a cube.
+    bool isDrawnWhole(uint32_t lightID) const;
+
+    /// Picks the dirty faces drawn this frame into scheduledFaces. Without
+    /// a budget that's all of them, otherwise the most important lights
+    /// go first, and ones that have waited for long move up the order.
+    void scheduleShadowFaces(size_t firstNewMap);
+
+    /// Node transform combined with the dequantization of its mesh.
+    glm::mat4 getDrawTransform(int nodeID) const;
+
     void propagateTransform(const glm::mat4& prev, int nodeID);
     void loadNodes();
+    void groupInstances();
     void loadAnimations();
+    void markDynamic(int nodeID);
 
     Renderer& renderer;
     
     const ScenePipelines& pipelines;
+    GeometryArena&        geometry;
+    const VIBConf         meshConf;
     
     tinygltf::TinyGLTF gltfLoader;
     tinygltf::Model    gltfModel;
@@ -175,11 +409,43 @@ private:
     std::vector<Animation>    animations;
     std::vector<MaterialData> materials;
     std::vector<int>          nodeDrawOrder;
+    std::vector<MeshInstances> meshInstances;
+    std::vector<int>          instanceNodes; // Nodes of meshInstances, grouped by mesh.
+    std::vector<int>          shadowCasters; // Nodes in range of the light being drawn to its shadow map.
+    eShadowCasters            shadowCasterLayer; // What shadowCasters was gathered for, also culled by on the GPU.
+    std::vector<TextureCubeShadowMap> staticShadowMaps; // Static casters of each light, see ShadowMapConf::staticLayer.
+    std::unique_ptr<TextureShadowAtlas> shadowAtlasTexture; // See ShadowMapConf::atlas.
+    std::vector<std::unique_ptr<TextureShadowAtlas>> omniShadowMaps; // Per light, unless ShadowMapConf::omni is the cube.
+    std::vector<uint8_t>      scheduledFaces; // Per light, bit per face, see scheduleShadowFaces().
+    ShadowAtlas               shadowAtlas;
+    std::vector<ShadowMapState> shadowMapStates; // Per shadow map.
+    std::vector<Aabb>         movedBounds;   // Old and new bounds of nodes moved since the shadow maps were drawn.
+    std::vector<uint8_t>      nodeVisible;   // Per node, what recordDrawPackets() draws.
+    std::vector<DrawPacket>   drawPackets[eSceneDrawTypeCount];
+    std::vector<DrawBucket>   drawBuckets[eSceneDrawTypeCount];
+    std::vector<VkDrawIndexedIndirectCommand> drawCommands[eSceneDrawTypeCount]; // Same order as the packets.
+    std::vector<glm::uvec2>   commandBuckets[eSceneDrawTypeCount]; // Per command, its bucket index and first command.
+    std::vector<DrawData>     drawData;
+    std::vector<NodeData>     nodeData;
+    bool                      nodeDataDirty;         // Transforms changed since the last upload.
+    bool                      packetsCullFrontFaces; // What the shadow map packets were built with.
+    std::vector<MeshletData>  meshlets; // Of all meshes, see VIBPrimGroup::firstMeshlet.
 
     std::unique_ptr<GpuShaderBuffer> lightBuffer;
     std::unique_ptr<GpuShaderBuffer> cameraBuffer;
+    std::unique_ptr<GpuShaderBuffer> cubeFaceBuffer; // Face matrices of every light for multiview shadow maps.
     std::unique_ptr<GpuShaderBuffer> materialBuffer;
+    std::unique_ptr<GpuShaderBuffer> meshletBuffer;
+    std::unique_ptr<GpuShaderBuffer> nodeBuffer;
+    std::unique_ptr<GpuShaderBuffer> drawBuffer;
+    std::unique_ptr<GpuShaderBuffer> drawIndexBuffer;   // Identity mapping of instances to draw data.
+    std::unique_ptr<GpuShaderBuffer> culledDrawIndices; // Visible instances from the culling pass, per view.
+    std::unique_ptr<GpuShaderBuffer> commandBuffers[eSceneDrawTypeCount]; // Indirect draw commands.
+    std::unique_ptr<GpuShaderBuffer> commandBucketBuffers[eSceneDrawTypeCount];
+    std::unique_ptr<GpuShaderBuffer> culledCommands; // Output of the culling pass, a full list per view.
+    std::unique_ptr<GpuShaderBuffer> drawCounts;     // Same, one count per bucket.
 
     PushConstants pushConstants;
     VkPipeline    lastBoundPipeline;
+    VkIndexType   boundIndexType; // Groups differ in index width.
 };
\ No newline at end of file
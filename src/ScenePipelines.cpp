@@ -6,6 +6,7 @@
 ///
 #include <cstdio>
 #include <iostream>
+#include <memory>
 #include "Common.hpp"
 #include "ScenePipelines.hpp"
 #include "PipelineLayoutBuilder.hpp"
@@ -24,8 +25,43 @@ static VkCullModeFlags cull_mode_from_scene_pipeline_flags(uint32_t flags) {
     return cullFlags;
 }
 
-ScenePipelines::ScenePipelines(Renderer& renderer, VkDescriptorSetLayout setLayout)
-    : renderer(renderer)
+/// With a non-zero view mask, the subpass renders to several layers of
+/// the attachment at once. Loading keeps what's already in the attachment,
+/// it has to be in the attachment layout then.
+static VkRenderPass create_shadow_map_render_pass(Renderer& renderer, uint32_t viewMask, VkAttachmentLoadOp loadOp) {
+    RenderPassBuilder rpb;
+    rpb.addAttachment(renderer.getBestDepthFormat(),
+                      loadOp,
+                      VK_ATTACHMENT_STORE_OP_STORE,
+                      loadOp == VK_ATTACHMENT_LOAD_OP_LOAD ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED,
+                      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+    rpb.addSubpass();
+    rpb.setSubpassDepthStencilAttachment(0, 0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+    rpb.setSubpassViewMask(0, viewMask);
+    constexpr VkSubpassDependency dependencyA = {
+        .srcSubpass      = VK_SUBPASS_EXTERNAL,
+        .dstSubpass      = 0,
+        .srcStageMask    = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        .dstStageMask    = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+        .srcAccessMask   = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        .dstAccessMask   = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+    };
+    constexpr VkSubpassDependency dependencyB = {
+        .srcSubpass      = 0,
+        .dstSubpass      = VK_SUBPASS_EXTERNAL,
+        .srcStageMask    = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        .dstStageMask    = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+        .srcAccessMask   = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        .dstAccessMask   = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+    };
+    rpb.addDependency(dependencyA);
+    rpb.addDependency(dependencyB);
+    return rpb.create(renderer);
+}
+
+ScenePipelines::ScenePipelines(Renderer& renderer, VkDescriptorSetLayout setLayout, eVertexFlags vertexFormat)
+    : vertexFormat(vertexFormat)
+    , renderer(renderer)
 {
     { // Main pipeline layout
         PipelineLayoutBuilder lb;
@@ -33,45 +69,27 @@ ScenePipelines::ScenePipelines(Renderer& renderer, VkDescriptorSetLayout setLayo
         lb.addDescriptorSetLayout(setLayout);
         layout = lb.create(renderer);
     }
-    { // Shadow map render pass
-        RenderPassBuilder rpb;
-        rpb.addAttachment(renderer.getBestDepthFormat(),
-                          VK_ATTACHMENT_LOAD_OP_CLEAR,
-                          VK_ATTACHMENT_STORE_OP_STORE,
-                          VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-        rpb.addSubpass();
-        rpb.setSubpassDepthStencilAttachment(0, 0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-        constexpr VkSubpassDependency dependencyA = {
-            .srcSubpass      = VK_SUBPASS_EXTERNAL,
-            .dstSubpass      = 0,
-            .srcStageMask    = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
-            .dstStageMask    = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
-            .srcAccessMask   = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
-            .dstAccessMask   = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
-        };
-        constexpr VkSubpassDependency dependencyB = {
-            .srcSubpass      = 0,
-            .dstSubpass      = VK_SUBPASS_EXTERNAL,
-            .srcStageMask    = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
-            .dstStageMask    = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
-            .srcAccessMask   = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
-            .dstAccessMask   = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
-        };
-        rpb.addDependency(dependencyA);
-        rpb.addDependency(dependencyB);
-        shadowMapRenderPass = rpb.create(renderer);
+    // Shadow map render passes, one face at a time or all six at once
+    // if the device has multiview.
+    shadowMapRenderPass      = create_shadow_map_render_pass(renderer, 0, VK_ATTACHMENT_LOAD_OP_CLEAR);
+    shadowMapLoadRenderPass  = create_shadow_map_render_pass(renderer, 0, VK_ATTACHMENT_LOAD_OP_LOAD);
+    shadowCubeRenderPass     = VK_NULL_HANDLE;
+    shadowCubeLoadRenderPass = VK_NULL_HANDLE;
+    if (renderer.getOptionalFeatures().multiview) {
+        shadowCubeRenderPass     = create_shadow_map_render_pass(renderer, 0x3F, VK_ATTACHMENT_LOAD_OP_CLEAR);
+        shadowCubeLoadRenderPass = create_shadow_map_render_pass(renderer, 0x3F, VK_ATTACHMENT_LOAD_OP_LOAD);
     }
 
     PipelineBuilder plb;
     plb.addDynamicState(VK_DYNAMIC_STATE_VIEWPORT);
     plb.addDynamicState(VK_DYNAMIC_STATE_SCISSOR);
-    plb.addVertexBinding(0, sizeof(VertexNT));
-    plb.addVertexAttributesFromFlags(0, eVertexFlags_Normal | eVertexFlags_TexCoord);
+    plb.addVertexBinding(0, vertex_size(vertexFormat));
+    plb.addVertexAttributesFromFlags(0, vertexFormat);
 
     createMainScenePipelines(plb);
     createStencilShadowVolumePipelines(plb);
     createShadowMapPipelines(plb);
+    createCullingPipeline();
 
     valid = true;
 }
@@ -88,6 +106,7 @@ void ScenePipelines::createMainScenePipelines(PipelineBuilder& plb) {
             uint32_t useShadowMaps;
             uint32_t outputAmbient;
             uint32_t outputDiffuse;
+            uint32_t packedNormals;
         } constants;
 
         static const VkSpecializationMapEntry mapEntries[] = {
@@ -95,6 +114,7 @@ void ScenePipelines::createMainScenePipelines(PipelineBuilder& plb) {
             { 1, sizeof(uint32_t)*1, sizeof(uint32_t) }, // USE_SHADOW_MAPS
             { 2, sizeof(uint32_t)*2, sizeof(uint32_t) }, // OUTPUT_AMBIENT
             { 3, sizeof(uint32_t)*3, sizeof(uint32_t) }, // OUTPUT_DIFFUSE
+            { 4, sizeof(uint32_t)*4, sizeof(uint32_t) }, // PACKED_NORMALS
         };
 
         VkSpecializationInfo spec;
@@ -104,6 +124,7 @@ void ScenePipelines::createMainScenePipelines(PipelineBuilder& plb) {
         spec.pData         = &constants;
 
         constants.enableAlphaTest = (i & eScenePipelineFlags_EnableAlphaTest);
+        constants.packedNormals   = (vertexFormat & eVertexFlags_Packed) != 0;
 
         plb.clearShaderStages();
         plb.clearBlendAttachments();
@@ -154,24 +175,59 @@ void ScenePipelines::createMainScenePipelines(PipelineBuilder& plb) {
     }
 }
 
+void ScenePipelines::createCullingPipeline() {
+    PipelineLayoutBuilder lb;
+    lb.addPushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, 0, 128);
+    cullLayout = lb.create(renderer);
+
+    Shader cullCS(renderer, "shaders/cull.comp.spirv");
+    VkComputePipelineCreateInfo ci = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+    ci.stage.sType  = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    ci.stage.stage  = VK_SHADER_STAGE_COMPUTE_BIT;
+    ci.stage.module = cullCS;
+    ci.stage.pName  = "main";
+    ci.layout       = cullLayout;
+    VKCHECK(vkCreateComputePipelines(renderer.getDevice(), VK_NULL_HANDLE, 1, &ci, nullptr, &cullDraws));
+}
+
 void ScenePipelines::createShadowMapPipelines(PipelineBuilder& plb) {
     Shader smapVertexShader  (renderer, "shaders/shadowmap.vert.spirv");
+    Shader smapOpaqueVS      (renderer, "shaders/shadowmapopaque.vert.spirv");
     Shader smapFragmentShader(renderer, "shaders/shadowmap.frag.spirv");
-    plb.setRenderPass(shadowMapRenderPass);
+
+    // The cube shaders use gl_ViewIndex and the paraboloid ones gl_ClipDistance,
+    // they can't be loaded without the matching device features.
+    const OptionalFeatures& features = renderer.getOptionalFeatures();
+    std::unique_ptr<Shader> cubeVertexShader, cubeOpaqueVS, dpVertexShader, dpOpaqueVS;
+    if (features.multiview) {
+        cubeVertexShader = std::make_unique<Shader>(renderer, "shaders/shadowcube.vert.spirv");
+        cubeOpaqueVS     = std::make_unique<Shader>(renderer, "shaders/shadowcubeopaque.vert.spirv");
+    }
+    if (features.clipDistance) {
+        dpVertexShader = std::make_unique<Shader>(renderer, "shaders/shadowparaboloid.vert.spirv");
+        dpOpaqueVS     = std::make_unique<Shader>(renderer, "shaders/shadowparaboloidopaque.vert.spirv");
+    }
     plb.addDynamicState(VK_DYNAMIC_STATE_DEPTH_BIAS);
     plb.setDepthBias(true);
 
-    // Ignore normals here since we're not using them in the shader.
-    plb.clearVertexBindings();
-    plb.addVertexBinding(0, sizeof(VertexNT));
-    plb.addVertexAttributesFromFlags(0, eVertexFlags_Normal|eVertexFlags_TexCoord, eVertexFlags_Normal);
-
     for (uint32_t i = 0; i <= eScenePipelineFlagsAll; ++i) {
+        const bool alphaTest = (i & eScenePipelineFlags_EnableAlphaTest) != 0;
+
+        // Positions come from the position-only stream. Only alpha tested
+        // pipelines also read the texcoords from the interleaved vertices.
+        plb.clearVertexBindings();
+        plb.addVertexBinding(0, position_size(vertexFormat));
+        plb.addVertexAttributesFromFlags(0, eVertexFlags(vertexFormat & eVertexFlags_QuantizedPosition));
+        if (alphaTest) {
+            plb.addVertexBinding(1, vertex_size(vertexFormat));
+            plb.addVertexAttributeFromFlags(1, 1, vertexFormat, eVertexFlags_TexCoord);
+        }
+
         static const VkSpecializationMapEntry mapEntries[] = {
             { 0, 0, sizeof(uint32_t) }, // ENABLE_ALPHA_TEST
         };
         uint32_t specData[ARRAY_COUNT(mapEntries)] = {
-            (i & eScenePipelineFlags_EnableAlphaTest) != 0, // ENABLE_ALPHA_TEST
+            alphaTest, // ENABLE_ALPHA_TEST
         };
         VkSpecializationInfo spec;
         spec.mapEntryCount = ARRAY_COUNT(mapEntries);
@@ -180,13 +236,34 @@ void ScenePipelines::createShadowMapPipelines(PipelineBuilder& plb) {
         spec.pData         = specData;
 
         plb.clearShaderStages();
-        plb.addVertexShader(smapVertexShader, &spec);
+        plb.addVertexShader(alphaTest ? smapVertexShader : smapOpaqueVS, &spec);
         plb.addFragmentShader(smapFragmentShader, &spec);
         plb.setDepthState((i & eScenePipelineFlags_EnableDepthTest) != 0,
                           (i & eScenePipelineFlags_EnableDepthWrite) != 0);
         plb.setStencilState(false);
         plb.setCulling(cull_mode_from_scene_pipeline_flags(i), VK_FRONT_FACE_COUNTER_CLOCKWISE);
+        plb.setRenderPass(shadowMapRenderPass);
         shadowMap[i] = plb.create(renderer);
+
+        // Same state, all six faces at once with the face picked by gl_ViewIndex.
+        shadowCube[i] = VK_NULL_HANDLE;
+        if (features.multiview) {
+            plb.clearShaderStages();
+            plb.addVertexShader(alphaTest ? *cubeVertexShader : *cubeOpaqueVS, &spec);
+            plb.addFragmentShader(smapFragmentShader, &spec);
+            plb.setRenderPass(shadowCubeRenderPass);
+            shadowCube[i] = plb.create(renderer);
+        }
+
+        // Same state again, projected onto a paraboloid in the vertex shader.
+        shadowParaboloid[i] = VK_NULL_HANDLE;
+        if (features.clipDistance) {
+            plb.clearShaderStages();
+            plb.addVertexShader(alphaTest ? *dpVertexShader : *dpOpaqueVS, &spec);
+            plb.addFragmentShader(smapFragmentShader, &spec);
+            plb.setRenderPass(shadowMapRenderPass);
+            shadowParaboloid[i] = plb.create(renderer);
+        }
     }
 }
 
@@ -233,7 +310,9 @@ void ScenePipelines::createStencilShadowVolumePipelines(PipelineBuilder& plb) {
     Shader svolVertexShader        (renderer, "shaders/shadowvolumes.vert.spirv");
     Shader svolGeometryShader      (renderer, "shaders/shadowvolumes.geom.spirv");
     Shader silhoutteGeometryShader (renderer, "shaders/svsilhouette.geom.spirv");
+    Shader silhoutteLinesShader    (renderer, "shaders/svsilhouettelines.geom.spirv");
     Shader silhoutteDebugShader    (renderer, "shaders/silhouettedebug.geom.spirv");
+    Shader silhoutteDebugLinesShader(renderer, "shaders/silhouettedebuglines.geom.spirv");
     Shader silhoutteDebugFragShader(renderer, "shaders/debug.frag.spirv");
     
     static const VkSpecializationMapEntry mapEntries[] = {
@@ -254,9 +333,10 @@ void ScenePipelines::createStencilShadowVolumePipelines(PipelineBuilder& plb) {
     spec.pMapEntries   = mapEntries;
     spec.pData         = &constants;
 
+    // Volumes only need positions, read them from the position-only stream.
     plb.clearVertexBindings();
-    plb.addVertexBinding(0, sizeof(VertexNT));
-    plb.addVertexAttributesFromFlags(0, eVertexFlags_Normal|eVertexFlags_TexCoord, eVertexFlags_Normal|eVertexFlags_TexCoord);
+    plb.addVertexBinding(0, position_size(vertexFormat));
+    plb.addVertexAttributesFromFlags(0, eVertexFlags(vertexFormat & eVertexFlags_QuantizedPosition));
     plb.setCulling(VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE);
 
     plb.clearShaderStages();
@@ -271,6 +351,13 @@ void ScenePipelines::createStencilShadowVolumePipelines(PipelineBuilder& plb) {
     plb.setPrimitive(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST_WITH_ADJACENCY);
     silhoutteDebug = plb.create(renderer);
 
+    plb.clearShaderStages();
+    plb.addVertexShader(svolVertexShader);
+    plb.addGeometryShader(silhoutteDebugLinesShader);
+    plb.addFragmentShader(silhoutteDebugFragShader);
+    plb.setPrimitive(VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY);
+    silhoutteDebugLines = plb.create(renderer);
+
     // NOTE:
     // For correct rendering of the depth fail method we need to have
     // depth clamping enabled for the extruded part and the back cap,
@@ -294,6 +381,20 @@ void ScenePipelines::createStencilShadowVolumePipelines(PipelineBuilder& plb) {
         plb.setDepthClamp(true);
         svDFailSilhoutte = plb.create(renderer);
     }
+    { // Silhoutte only, edges with exactly two faces
+        plb.clearShaderStages();
+        plb.addVertexShader(svolVertexShader);
+        plb.addGeometryShader(silhoutteLinesShader);
+        plb.setPrimitive(VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY);
+
+        plb.setStencilState(true, depthPassFront, depthPassBack);
+        plb.setDepthClamp(false);
+        svDPassSilhoutteLines = plb.create(renderer);
+
+        plb.setStencilState(true, depthFailFront, depthFailBack);
+        plb.setDepthClamp(true);
+        svDFailSilhoutteLines = plb.create(renderer);
+    }
     { // All triangles
         plb.clearShaderStages();
         plb.addVertexShader(svolVertexShader);
@@ -350,19 +451,29 @@ ScenePipelines::~ScenePipelines() {
     DESTROY_ITERABLE(sceneAmbientOnly);
     DESTROY_ITERABLE(sceneDiffuseOnlyST);
     DESTROY_ITERABLE(shadowMap);
+    DESTROY_ITERABLE(shadowCube);
+    DESTROY_ITERABLE(shadowParaboloid);
 
     DESTROY(silhoutteDebug);
+    DESTROY(silhoutteDebugLines);
     DESTROY(svDPass);
     DESTROY(svDPassSilhoutte);
     DESTROY(svDFailSilhoutte);
+    DESTROY(svDPassSilhoutteLines);
+    DESTROY(svDFailSilhoutteLines);
     DESTROY(svDFailFrontCap);
     DESTROY(svDFailSidesBackCap);
     DESTROY(svDFailBackCap);
+    DESTROY(cullDraws);
     #undef DESTROY_ITERABLE
     #undef DESTROY
 
     vkDestroyPipelineLayout(renderer.getDevice(), layout, nullptr);
+    vkDestroyPipelineLayout(renderer.getDevice(), cullLayout, nullptr);
     vkDestroyRenderPass(renderer.getDevice(), shadowMapRenderPass, nullptr);
+    vkDestroyRenderPass(renderer.getDevice(), shadowCubeRenderPass, nullptr);
+    vkDestroyRenderPass(renderer.getDevice(), shadowMapLoadRenderPass, nullptr);
+    vkDestroyRenderPass(renderer.getDevice(), shadowCubeLoadRenderPass, nullptr);
 }
 
 ScenePipelines::ScenePipelines(ScenePipelines&& o)
@@ -7,6 +7,7 @@
 #pragma once
 
 #include "Renderer.hpp"
+#include "Vertex.hpp"
 
 enum eScenePipelineFlags {
     eScenePipelineFlags_CullBackFace     = (1 << 0),
@@ -28,8 +29,9 @@ struct PipelineBuilder;
 struct ScenePipelines {
     /// Generates VkPipeline objects along with other objects
     /// for all possible configurations of eScenePipelineShader
-    /// and eScenePipelineFlags.
-    ScenePipelines(Renderer& renderer, VkDescriptorSetLayout setLayout);
+    /// and eScenePipelineFlags. All of them read vertices in the format
+    /// described by `vertexFormat`.
+    ScenePipelines(Renderer& renderer, VkDescriptorSetLayout setLayout, eVertexFlags vertexFormat);
     
     /// Destructor
     ~ScenePipelines();
@@ -44,24 +46,37 @@ private:
     void createMainScenePipelines(PipelineBuilder& plb);
     void createShadowMapPipelines(PipelineBuilder& plb);
     void createStencilShadowVolumePipelines(PipelineBuilder& plb);
+    void createCullingPipeline();
 public:
     bool valid;
+    eVertexFlags vertexFormat;
     VkPipelineLayout layout;          /// Common pipeline layout.
+    VkPipelineLayout cullLayout;      /// Layout of the culling compute pipeline.
     VkRenderPass shadowMapRenderPass; /// Render pass to use when drawing to shadow maps.
+    VkRenderPass shadowCubeRenderPass; /// Same for all six cube faces at once, null without multiview.
+    VkRenderPass shadowMapLoadRenderPass;  /// These two draw over the existing contents instead of clearing,
+    VkRenderPass shadowCubeLoadRenderPass; /// they're compatible with the ones above.
 
     VkPipeline scene[eScenePipelineFlagsAll+1];              // Shadowless scene
     VkPipeline sceneShadowMapped[eScenePipelineFlagsAll+1];  // Scene with shadow maps applied.
     VkPipeline sceneAmbientOnly[eScenePipelineFlagsAll+1];   // Scene with only ambient lighting.
     VkPipeline sceneDiffuseOnlyST[eScenePipelineFlagsAll+1]; // Scene with only stencil-tested diffuse lighting.
     VkPipeline shadowMap[eScenePipelineFlagsAll+1];          // For drawing to shadow maps.
+    VkPipeline shadowCube[eScenePipelineFlagsAll+1];         // For drawing to all faces of a cube shadow map, if multiview is supported.
+    VkPipeline shadowParaboloid[eScenePipelineFlagsAll+1];   // For drawing to one half of a dual-paraboloid shadow map, if clip distances are supported.
 
     VkPipeline silhoutteDebug;      // Silhoutte debugging lines
+    VkPipeline silhoutteDebugLines; // Silhoutte debugging lines, 2-face edge stream
     VkPipeline svDPass;             // Depth Pass
     VkPipeline svDPassSilhoutte;    // Depth Pass but for silhoutte only
     VkPipeline svDFailSilhoutte;    // Depth Fail but for silhoutte only
+    VkPipeline svDPassSilhoutteLines; // Same as above, for the 2-face edge stream
+    VkPipeline svDFailSilhoutteLines;
     VkPipeline svDFailFrontCap;     // Front Cap (depth clamp disabled)
     VkPipeline svDFailSidesBackCap; // Volume + Back Cap (depth clamp enabled)
     VkPipeline svDFailBackCap;      // Back Cap (depth clamp enabled)
 
+    VkPipeline cullDraws;           // Compute, frustum culling of indirect draws
+
     Renderer& renderer;
 };
\ No newline at end of file
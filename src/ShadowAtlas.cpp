@@ -0,0 +1,97 @@
+///
+/// Vulkan Shadows
+/// Author: Fedor Vorobev
+///
+/// Tile allocator for the shadow map atlas.
+///
+#include <algorithm>
+#include <bit>
+#include "ShadowAtlas.hpp"
+
+ShadowAtlas::ShadowAtlas(uint32_t size)
+    : size(0)
+    , usedArea(0)
+{
+    reset(size);
+}
+
+bool ShadowAtlas::allocate(uint32_t tileSize, Tile& out) {
+    if (tileSize < MIN_TILE_SIZE || tileSize > size || !std::has_single_bit(tileSize)) {
+        return false;
+    }
+    const uint32_t level = getLevel(tileSize);
+
+    // Split the smallest free tile that's still large enough.
+    int from = int(level);
+    while (from >= 0 && freeTiles[from].empty()) {
+        --from;
+    }
+    if (from < 0) {
+        return false;
+    }
+    glm::uvec2 pos = freeTiles[from].back();
+    freeTiles[from].pop_back();
+    for (uint32_t l = from + 1; l <= level; ++l) {
+        const uint32_t half = size >> l;
+        freeTiles[l].push_back(pos + glm::uvec2(half, 0));
+        freeTiles[l].push_back(pos + glm::uvec2(0, half));
+        freeTiles[l].push_back(pos + glm::uvec2(half, half));
+    }
+
+    out = { pos.x, pos.y, tileSize };
+    usedArea += uint64_t(tileSize) * tileSize;
+    return true;
+}
+
+void ShadowAtlas::free(const Tile& tile) {
+    if (tile.size == 0) {
+        return;
+    }
+    usedArea -= uint64_t(tile.size) * tile.size;
+
+    glm::uvec2 pos   = { tile.x, tile.y };
+    uint32_t   level = getLevel(tile.size);
+    while (level > 0) {
+        const uint32_t   tileSize = size >> level;
+        const glm::uvec2 parent   = pos - pos % (tileSize * 2);
+        const glm::uvec2 siblings[4] = {
+            parent,
+            parent + glm::uvec2(tileSize, 0),
+            parent + glm::uvec2(0, tileSize),
+            parent + glm::uvec2(tileSize, tileSize),
+        };
+
+        // Merge only if the other three are free as well.
+        auto& list = freeTiles[level];
+        uint32_t found = 0;
+        for (const auto& sibling : siblings) {
+            if (sibling != pos && std::find(list.begin(), list.end(), sibling) != list.end()) {
+                found++;
+            }
+        }
+        if (found != 3) {
+            break;
+        }
+        std::erase_if(list, [&](const glm::uvec2& p) {
+            return std::find(std::begin(siblings), std::end(siblings), p) != std::end(siblings);
+        });
+        pos = parent;
+        level--;
+    }
+    freeTiles[level].push_back(pos);
+}
+
+void ShadowAtlas::reset(uint32_t newSize) {
+    size     = newSize;
+    usedArea = 0;
+    freeTiles.clear();
+    if (size < MIN_TILE_SIZE) {
+        return;
+    }
+    freeTiles.resize(getLevel(MIN_TILE_SIZE) + 1);
+    freeTiles[0].push_back({ 0, 0 });
+}
+
+uint32_t ShadowAtlas::getLevel(uint32_t tileSize) const {
+    return std::countr_zero(size) - std::countr_zero(tileSize);
+}
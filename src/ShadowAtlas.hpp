@@ -0,0 +1,51 @@
+///
+/// Vulkan Shadows
+/// Author: Fedor Vorobev
+///
+/// Tile allocator for the shadow map atlas.
+///
+/// The atlas is one large square depth texture that the cube faces of all
+/// lights are drawn to, each face to its own square tile. Tile sizes are
+/// powers of two, allocated like a quadtree: a free tile is split into
+/// four until it's small enough and freed tiles merge back with their
+/// siblings. Allocating from the largest tiles down never fails as long
+/// as the total area fits.
+///
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "glm.hpp"
+
+class ShadowAtlas {
+public:
+    static constexpr uint32_t MIN_TILE_SIZE = 64;
+
+    struct Tile {
+        uint32_t x;
+        uint32_t y;
+        uint32_t size; // 0 if the tile isn't allocated.
+    };
+
+    /// Size of the whole atlas, a power of two.
+    ShadowAtlas(uint32_t size = 0);
+
+    /// Returns false if there's no free tile large enough. The size has
+    /// to be a power of two between MIN_TILE_SIZE and the atlas size.
+    bool allocate(uint32_t tileSize, Tile& out);
+
+    /// Returns the tile, merging it with its siblings if they're free too.
+    void free(const Tile& tile);
+
+    /// Frees all tiles, optionally changing the size of the atlas.
+    void reset(uint32_t newSize);
+
+    uint32_t getSize()     const { return size;     }
+    uint64_t getUsedArea() const { return usedArea; }
+private:
+    uint32_t getLevel(uint32_t tileSize) const;
+
+    std::vector<std::vector<glm::uvec2>> freeTiles; // Per level, level 0 is the whole atlas.
+    uint32_t size;
+    uint64_t usedArea; // In texels.
+};
@@ -34,6 +34,9 @@ Swapchain::Swapchain(Renderer& renderer)
     , acquireAttemptCounter(0)
     , outdated(false)
     , swapchain(nullptr)
+    , shadowTimed(false)
+    , frameTime(0)
+    , shadowTime(0)
 {
     fetchCaps();
     createSwapchain();
@@ -310,8 +313,9 @@ void Swapchain::recordFrame(std::function<void(Swapchain&, VkCommandBuffer)> con
     vkBeginCommandBuffer(commandBuffer, &cbbi);
 
     // Record timestamps if needed.
+    shadowTimed = false;
     if (renderer.settings.needTimestamps) {
-        vkCmdResetQueryPool(commandBuffer, renderer.queryPool, 0, 2);
+        vkCmdResetQueryPool(commandBuffer, renderer.queryPool, 0, ARRAY_COUNT(timestamps));
         vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, renderer.queryPool, 0);
     }
     recordFunction(*this, commandBuffer);
@@ -357,11 +361,31 @@ void Swapchain::recordFrame(std::function<void(Swapchain&, VkCommandBuffer)> con
         // I expected it to do. Waiting on the render fence is required, otherwise
         // the timestamp values can be undefined.
         vkWaitForFences(renderer.device, 1, &renderFence, VK_TRUE, UINT64_MAX);
-        VKCHECK(vkGetQueryPoolResults(renderer.device, renderer.queryPool, 0, ARRAY_COUNT(timestamps), sizeof(timestamps),
+        // The shadow ones were never written without shadow maps, waiting
+        // for them would never finish.
+        const uint32_t count = shadowTimed ? 4 : 2;
+        VKCHECK(vkGetQueryPoolResults(renderer.device, renderer.queryPool, 0, count, sizeof(timestamps),
                                       timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
-        double delta = (timestamps[1] - timestamps[0]) & renderer.timestampMask;
-        double milliseconds = delta * renderer.deviceProperties.limits.timestampPeriod / 1000000.0;
-        std::cout << milliseconds << "\n";
+        const auto to_milliseconds = [&](uint64_t begin, uint64_t end) {
+            double delta = (end - begin) & renderer.timestampMask;
+            return delta * renderer.deviceProperties.limits.timestampPeriod / 1000000.0;
+        };
+        frameTime  = to_milliseconds(timestamps[0], timestamps[1]);
+        shadowTime = shadowTimed ? to_milliseconds(timestamps[2], timestamps[3]) : 0.0;
+        std::cout << frameTime << "\n";
+    }
+}
+
+void Swapchain::beginShadowTimer() {
+    if (renderer.settings.needTimestamps) {
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, renderer.queryPool, 2);
+    }
+}
+
+void Swapchain::endShadowTimer() {
+    if (renderer.settings.needTimestamps) {
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, renderer.queryPool, 3);
+        shadowTimed = true;
     }
 }
 
@@ -29,6 +29,12 @@ public:
     void beginRenderPass();
     void setDefaultViewportScissor();
 
+    /// Put around the shadow map passes of the frame being recorded, their
+    /// GPU time is in getShadowTime() once the frame is done. Only records
+    /// anything with timestamps enabled, i.e. in test mode.
+    void beginShadowTimer();
+    void endShadowTimer();
+
     uint32_t         getImageCount()   const { return textures.size(); }
     uint32_t         getCurrentImage() const { return imageIndex; } 
     VkRenderPass     getRenderPass()   const { return renderPass; }
@@ -38,6 +44,8 @@ public:
     VkExtent2D       getExtent()       const { return extent; }
     VkFormat         getFormat()       const { return surfaceFormat.format; }
     VkPresentModeKHR getPresentMode()  const { return presentMode; }
+    double           getFrameTime()    const { return frameTime; }  // GPU milliseconds of the last frame.
+    double           getShadowTime()   const { return shadowTime; } // Same for its shadow map passes, 0 without them.
 
     void markAsOutdated() { outdated = true; };
 private:
@@ -73,7 +81,10 @@ private:
     VkSemaphore                   renderFinishedSema;
     VkFence                       renderFence;
     uint32_t                      imageIndex;
-    uint64_t                      timestamps[2];
+    uint64_t                      timestamps[4]; // Frame begin/end, shadow maps begin/end.
+    bool                          shadowTimed;   // The shadow timer was used this frame.
+    double                        frameTime;
+    double                        shadowTime;
 
     std::vector<VkPresentModeKHR>   availablePresentModes;
     std::vector<VkSurfaceFormatKHR> availableSurfaceFormats;
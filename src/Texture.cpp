@@ -62,7 +62,7 @@ Texture2D::Texture2D(Renderer& renderer, VkFormat format, uint32_t width, uint32
               height)
 {}
 
-TextureCubeShadowMap::TextureCubeShadowMap(Renderer& renderer, VkRenderPass renderPass, uint32_t pxSize)
+TextureCubeShadowMap::TextureCubeShadowMap(Renderer& renderer, VkRenderPass renderPass, uint32_t pxSize, bool layered)
     : Texture(renderer.getDevice(),
               renderer.getAllocator(),
               eTextureUsage_Depth,
@@ -70,24 +70,39 @@ TextureCubeShadowMap::TextureCubeShadowMap(Renderer& renderer, VkRenderPass rend
               renderer.getBestDepthFormat(),
               VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
               pxSize, pxSize, 6)
+    , layeredFramebuffer(VK_NULL_HANDLE)
+    , layeredView(VK_NULL_HANDLE)
 {
+    memset(framebuffers, 0, sizeof(framebuffers));
+    memset(faceViews, 0, sizeof(faceViews));
+
     VkImageViewCreateInfo vci = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
     vci.viewType         = VK_IMAGE_VIEW_TYPE_2D;
     vci.image            = image;
     vci.format           = format;
     vci.components       = { VK_COMPONENT_SWIZZLE_R };
     vci.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
-    for (uint32_t i = 0; i < 6; ++i) {
-        vci.subresourceRange.baseArrayLayer = i;
-        VKCHECK(vkCreateImageView(device, &vci, nullptr, &faceViews[i]));
-    }
 
     VkFramebufferCreateInfo fci = { VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
     fci.renderPass      = renderPass;
     fci.attachmentCount = 1;
     fci.width           = pxSize;
     fci.height          = pxSize;
-    fci.layers          = 1;
+    fci.layers          = 1; // Also with multiview, the view mask picks the layers.
+
+    if (layered) {
+        vci.viewType         = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+        vci.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 6 };
+        VKCHECK(vkCreateImageView(device, &vci, nullptr, &layeredView));
+        fci.pAttachments = &layeredView;
+        VKCHECK(vkCreateFramebuffer(device, &fci, nullptr, &layeredFramebuffer));
+        return;
+    }
+
+    for (uint32_t i = 0; i < 6; ++i) {
+        vci.subresourceRange.baseArrayLayer = i;
+        VKCHECK(vkCreateImageView(device, &vci, nullptr, &faceViews[i]));
+    }
     for (uint32_t i = 0; i < 6; ++i) {
         fci.pAttachments = &faceViews[i];
         VKCHECK(vkCreateFramebuffer(device, &fci, nullptr, &framebuffers[i]));
@@ -103,15 +118,48 @@ TextureCubeShadowMap::~TextureCubeShadowMap() {
         vkDestroyImageView(device, v, nullptr);
         v = VK_NULL_HANDLE;
     }
+    vkDestroyFramebuffer(device, layeredFramebuffer, nullptr);
+    vkDestroyImageView(device, layeredView, nullptr);
+    layeredFramebuffer = VK_NULL_HANDLE;
+    layeredView        = VK_NULL_HANDLE;
 }
 
 TextureCubeShadowMap::TextureCubeShadowMap(TextureCubeShadowMap&& o)
     : Texture(std::move(o))
+    , layeredFramebuffer(o.layeredFramebuffer)
+    , layeredView(o.layeredView)
 {
     memcpy(framebuffers, o.framebuffers, sizeof(framebuffers));
     memcpy(faceViews, o.faceViews, sizeof(faceViews));
     memset(o.framebuffers, 0, sizeof(o.framebuffers));
     memset(o.faceViews, 0, sizeof(o.faceViews));
+    o.layeredFramebuffer = VK_NULL_HANDLE;
+    o.layeredView        = VK_NULL_HANDLE;
+}
+
+TextureShadowAtlas::TextureShadowAtlas(Renderer& renderer, VkRenderPass renderPass, uint32_t pxWidth, uint32_t pxHeight)
+    : Texture(renderer.getDevice(),
+              renderer.getAllocator(),
+              eTextureUsage_Depth,
+              VK_IMAGE_VIEW_TYPE_2D,
+              renderer.getBestDepthFormat(),
+              VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+              pxWidth, pxHeight)
+    , framebuffer(VK_NULL_HANDLE)
+{
+    VkFramebufferCreateInfo fci = { VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
+    fci.renderPass      = renderPass;
+    fci.attachmentCount = 1;
+    fci.pAttachments    = &view;
+    fci.width           = pxWidth;
+    fci.height          = pxHeight;
+    fci.layers          = 1;
+    VKCHECK(vkCreateFramebuffer(device, &fci, nullptr, &framebuffer));
+}
+
+TextureShadowAtlas::~TextureShadowAtlas() {
+    vkDestroyFramebuffer(device, framebuffer, nullptr);
+    framebuffer = VK_NULL_HANDLE;
 }
 
 Texture::~Texture() {
@@ -124,7 +124,10 @@ public:
 /// Cube depth texture for rendering and sampling.
 class TextureCubeShadowMap : public Texture {
 public:
-    TextureCubeShadowMap(Renderer& renderer, VkRenderPass renderPass, uint32_t pxSize);
+    /// With `layered`, `renderPass` has to be a multiview pass drawing to
+    /// all six faces and there's just one framebuffer for it. Otherwise
+    /// there's one per face.
+    TextureCubeShadowMap(Renderer& renderer, VkRenderPass renderPass, uint32_t pxSize, bool layered = false);
     ~TextureCubeShadowMap();
 
     /// No copying.
@@ -135,7 +138,29 @@ public:
 
     VkFramebuffer getFramebuffer(uint32_t faceID) const { return framebuffers[faceID]; }
     VkImageView   getFaceView(uint32_t faceID)    const { return faceViews[faceID];    }
+    VkFramebuffer getLayeredFramebuffer()         const { return layeredFramebuffer;   }
+    bool          isLayered()                     const { return layeredFramebuffer != VK_NULL_HANDLE; }
 private:
     VkFramebuffer framebuffers[6];
     VkImageView   faceViews[6];
+    VkFramebuffer layeredFramebuffer;
+    VkImageView   layeredView; // All faces as a 2D array.
+};
+
+/// Depth texture with the cube faces of many lights drawn to square
+/// tiles of it, see ShadowAtlas.
+class TextureShadowAtlas : public Texture {
+public:
+    /// `renderPass` should load the attachment, each face clears its own tile.
+    /// Also holds the halves or faces of one light's dual-paraboloid or
+    /// tetrahedral shadow map, side by side.
+    TextureShadowAtlas(Renderer& renderer, VkRenderPass renderPass, uint32_t pxWidth, uint32_t pxHeight);
+    ~TextureShadowAtlas();
+
+    /// No copying.
+    TextureShadowAtlas(const TextureShadowAtlas&) = delete;
+
+    VkFramebuffer getFramebuffer() const { return framebuffer; }
+private:
+    VkFramebuffer framebuffer;
 };
\ No newline at end of file
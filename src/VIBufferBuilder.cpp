@@ -12,33 +12,133 @@
 /// (first edge vertex).
 /// Intended for access from the geometry shader.
 ///
+/// In compact mode, edges with exactly two adjacent triangles are written
+/// to a separate "line list with adjacency" stream of 4 indices per edge.
+///
 #include <stdexcept>
-#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cmath>
+#include <format>
+#include <glm/gtc/packing.hpp>
 #include "VIBufferBuilder.hpp"
 
-VIBufferBuilder::VIBufferBuilder(Renderer& renderer, const tinygltf::Model& gltfModel, const tinygltf::Mesh& gltfMesh)
-    : renderer(renderer)
-    , stagingBufferSize(calcStagingSize(gltfModel, gltfMesh))
-    , staging(renderer, stagingBufferSize)
-    , mappedStaging(reinterpret_cast<uint8_t*>(staging.getMappedData()))
-    , stgVertices(reinterpret_cast<VertexNT*>(mappedStaging + vbOffset))
-    , stgIndices(reinterpret_cast<uint32_t*>(mappedStaging + ibOffset))
+VIBufferBuilder::VIBufferBuilder(const tinygltf::Model& gltfModel, const tinygltf::Mesh& gltfMesh, const VIBConf& conf)
+    : conf(conf)
+    , name(gltfMesh.name)
 {
+    calcBufferLayout(gltfModel, gltfMesh);
     readVertices(gltfModel, gltfMesh);
     readIndices(gltfModel, gltfMesh);
+    if (conf.optimize) {
+        optimizeGroups(); // Before anything derived from the index order.
+    }
+    calcBounds();
     findEdges();
+    if (conf.pruneEdges) {
+        pruneEdges();
+    }
     unpackEdges();
+    buildMeshlets();
+    packIndexStreams();
+}
+
+static void write_indices(const uint32_t* src, uint32_t count, VkIndexType type, uint8_t* dst) {
+    if (type == VK_INDEX_TYPE_UINT16) {
+        uint16_t* out = reinterpret_cast<uint16_t*>(dst);
+        for (uint32_t i = 0; i < count; ++i) {
+            out[i] = uint16_t(src[i]);
+        }
+    } else {
+        memcpy(dst, src, count * sizeof(uint32_t));
+    }
+}
+
+static int16_t pack_snorm16(float v) {
+    return int16_t(std::round(std::clamp(v, -1.0f, 1.0f) * 32767.0f));
+}
+
+static uint16_t pack_unorm16(float v) {
+    return uint16_t(std::round(std::clamp(v, 0.0f, 1.0f) * 65535.0f));
+}
+
+/// Octahedral normal encoding, the decoder is in scene.vert.
+static void pack_normal(glm::vec3 n, int16_t out[2]) {
+    float sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (sum == 0.0f) {
+        out[0] = out[1] = 0; // Missing normal, decodes to +Z.
+        return;
+    }
+    n /= sum;
+    glm::vec2 e(n.x, n.y);
+    if (n.z < 0.0f) {
+        e.x = (1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+        e.y = (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    out[0] = pack_snorm16(e.x);
+    out[1] = pack_snorm16(e.y);
 }
 
-GpuVertexIndexBuffer VIBufferBuilder::create() {
-    GpuVertexIndexBuffer out(renderer, stagingBufferSize);
-    renderer.recordOneTime([&](VkCommandBuffer cmdbuf) {
-        out.copyFrom(cmdbuf, staging, stagingBufferSize);
-    });
-    return out;
+static void pack_tex_coord(glm::vec2 t, uint16_t out[2]) {
+    out[0] = glm::packHalf1x16(t.x);
+    out[1] = glm::packHalf1x16(t.y);
 }
 
-uint32_t VIBufferBuilder::calcStagingSize(const tinygltf::Model& gltfModel, const tinygltf::Mesh& gltfMesh) {
+void VIBufferBuilder::writeBufferData(void* dst) const {
+    uint8_t* out = reinterpret_cast<uint8_t*>(dst);
+    if (conf.vertexFormat & eVertexFlags_QuantizedPosition) {
+        auto* packed    = reinterpret_cast<VertexQuantizedNT*>(out + vbOffset);
+        auto* positions = reinterpret_cast<uint16_t*>(out + pbOffset);
+        for (uint32_t i = 0; i < vertices.size(); ++i) {
+            const auto& v = vertices[i];
+            glm::vec3 q = (v.position - boundsMin) / boundsExtent;
+            packed[i].position[0] = pack_unorm16(q.x);
+            packed[i].position[1] = pack_unorm16(q.y);
+            packed[i].position[2] = pack_unorm16(q.z);
+            packed[i].position[3] = 0;
+            memcpy(positions + i * 4, packed[i].position, sizeof(packed[i].position));
+            // The bounds scale ends up in the transform, and with it in
+            // the normal matrix the shader derives from it. Prescaling the
+            // normals by the same amount cancels that out.
+            pack_normal(v.normal * boundsExtent, packed[i].normal);
+            pack_tex_coord(v.texCoord, packed[i].texCoord);
+        }
+    } else if (conf.vertexFormat & eVertexFlags_Packed) {
+        auto* packed = reinterpret_cast<VertexPackedNT*>(out + vbOffset);
+        for (uint32_t i = 0; i < vertices.size(); ++i) {
+            const auto& v = vertices[i];
+            packed[i].position = v.position;
+            pack_normal(v.normal, packed[i].normal);
+            pack_tex_coord(v.texCoord, packed[i].texCoord);
+        }
+    } else {
+        memcpy(out + vbOffset, vertices.data(), vbSize);
+    }
+    if ((conf.vertexFormat & eVertexFlags_QuantizedPosition) == 0) {
+        auto* positions = reinterpret_cast<glm::vec3*>(out + pbOffset);
+        for (uint32_t i = 0; i < vertices.size(); ++i) {
+            positions[i] = vertices[i].position;
+        }
+    }
+
+    // Padding between groups is left as is, nothing ever reads it.
+    for (uint32_t g = 0; g < groups.size(); ++g) {
+        const auto& group  = groups[g];
+        const auto& source = sources[g];
+        const uint32_t size = index_type_size(group.indexType);
+        write_indices(indices.data() + source.firstIndex,
+                      group.indexCount,
+                      group.indexType,
+                      out + ibOffset + group.firstIndex * size);
+        write_indices(edgeIndices.data() + source.firstEdgeIndex,
+                      group.edgeIndexCount + group.edgeLineIndexCount,
+                      group.indexType,
+                      out + ebOffset + group.firstEdgeIndex * size);
+    }
+}
+
+void VIBufferBuilder::calcBufferLayout(const tinygltf::Model& gltfModel, const tinygltf::Mesh& gltfMesh) {
     totalVertexCount = 0;
     totalIndexCount  = 0;
     for (const auto& gltfGroup : gltfMesh.primitives) {
@@ -48,18 +148,19 @@ uint32_t VIBufferBuilder::calcStagingSize(const tinygltf::Model& gltfModel, cons
         totalIndexCount  += gltfModel.accessors[iAccessor].count;
     }
 
-    // 2 indices for the edge itself and 4 for the opposite vertices
-    totalEdgeIndexCount = totalIndexCount * 6;
-
-    vbSize = totalVertexCount    * sizeof(VertexNT);
-    ibSize = totalIndexCount     * sizeof(uint32_t);
-    ebSize = totalEdgeIndexCount * sizeof(uint32_t);
+    // Index and edge sizes are known only after packIndexStreams().
+    vbSize = totalVertexCount * vertex_size(conf.vertexFormat);
+    pbSize = totalVertexCount * position_size(conf.vertexFormat);
+    ibSize = 0;
+    ebSize = 0;
 
     vbOffset = 0;
-    ibOffset = vbOffset + vbSize;
-    ebOffset = ibOffset + ibSize;
+    pbOffset = vbOffset + vbSize;
+    ibOffset = pbOffset + pbSize;
+    ebOffset = ibOffset;
 
-    return vbSize + ibSize + ebSize;
+    vertices.resize(totalVertexCount);
+    indices.resize(totalIndexCount);
 }
 
 void VIBufferBuilder::readVertices(const tinygltf::Model& gltfModel, const tinygltf::Mesh& gltfMesh) {
@@ -93,7 +194,7 @@ void VIBufferBuilder::readVertices(const tinygltf::Model& gltfModel, const tinyg
         const auto tData = tBuffer.data.data() + tView.byteOffset + tAccessor.byteOffset;
 
         group.materialID   = uint32_t(gltfGroup.material);
-        group.vertexOffset = vbOffset + vpos * sizeof(VertexNT);
+        group.vertexOffset = vpos;
         group.vertexCount  = pAccessor.count;
 
         uint32_t pStride = pView.byteStride;
@@ -103,7 +204,7 @@ void VIBufferBuilder::readVertices(const tinygltf::Model& gltfModel, const tinyg
         if (nStride == 0) nStride = sizeof(glm::vec3);
         if (tStride == 0) tStride = sizeof(glm::vec2);
         for (uint32_t i = 0; i < group.vertexCount; ++i) {
-            auto& vertex = stgVertices[vpos++];
+            auto& vertex = vertices[vpos++];
             vertex.position = *(glm::vec3*)(pData + i * pStride);
             if (hasNormals)   { vertex.normal   = *(glm::vec3*)(nData + i * nStride); }
             if (hasTexCoords) { vertex.texCoord = *(glm::vec2*)(tData + i * tStride); }
@@ -122,7 +223,7 @@ void VIBufferBuilder::readIndices(const tinygltf::Model& gltfModel, const tinygl
         const auto& iBuffer   = gltfModel.buffers[iView.buffer];
         const auto  iData     = iBuffer.data.data() + iView.byteOffset + iAccessor.byteOffset;
 
-        group.indexOffset = ibOffset + index * sizeof(uint32_t);
+        group.firstIndex  = index;
         group.indexCount  = iAccessor.count;
 
         switch (iAccessor.componentType) {
@@ -131,65 +232,389 @@ void VIBufferBuilder::readIndices(const tinygltf::Model& gltfModel, const tinygl
             break;
         case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
             for (uint32_t i = 0; i < iAccessor.count; ++i) {
-                stgIndices[index++] = ((uint32_t*)iData)[i];
+                indices[index++] = ((uint32_t*)iData)[i];
             }
             break;
         case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
             for (uint32_t i = 0; i < iAccessor.count; ++i) {
-                stgIndices[index++] = ((uint16_t*)iData)[i];
+                indices[index++] = ((uint16_t*)iData)[i];
             }
             break;
         case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
             for (uint32_t i = 0; i < iAccessor.count; ++i) {
-                stgIndices[index++] = ((uint8_t*)iData)[i];
+                indices[index++] = ((uint8_t*)iData)[i];
             }
             break;
         }
     }
 }
 
+void VIBufferBuilder::optimizeGroups() {
+    MeshOptimizer::CacheStats before = {};
+    MeshOptimizer::CacheStats after  = {};
+    const auto accumulate = [](MeshOptimizer::CacheStats& total, const MeshOptimizer::CacheStats& stats) {
+        total.transformed += stats.transformed;
+        total.triangles   += stats.triangles;
+        total.vertices    += stats.vertices;
+    };
+
+    for (auto& group : groups) {
+        uint32_t* groupIndices  = indices.data() + group.firstIndex;
+        VertexNT* groupVertices = vertices.data() + group.vertexOffset;
+
+        bool valid = (group.indexCount % 3) == 0;
+        for (uint32_t i = 0; valid && i < group.indexCount; ++i) {
+            valid = groupIndices[i] < group.vertexCount;
+        }
+        if (!valid) {
+            continue; // Leave broken groups as they are.
+        }
+
+        accumulate(before, optimizer.analyze(groupIndices, group.indexCount, group.vertexCount));
+        optimizer.optimizeTriangleOrder(groupIndices, group.indexCount, groupVertices, group.vertexCount);
+        optimizer.optimizeVertexOrder(groupIndices, group.indexCount, groupVertices, group.vertexCount);
+        accumulate(after, optimizer.analyze(groupIndices, group.indexCount, group.vertexCount));
+    }
+
+    if (before.triangles > 0) {
+        log += std::format("Cache optimization of mesh '{}': ACMR {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f}.\n",
+                           name,
+                           double(before.transformed) / before.triangles,
+                           double(after.transformed)  / after.triangles,
+                           double(before.transformed) / before.vertices,
+                           double(after.transformed)  / after.vertices);
+    }
+}
+
+void VIBufferBuilder::calcBounds() {
+    if (vertices.empty()) {
+        boundsMin    = glm::vec3(0.0f);
+        boundsExtent = glm::vec3(1.0f);
+        return;
+    }
+    glm::vec3 lo = vertices[0].position;
+    glm::vec3 hi = vertices[0].position;
+    for (const auto& v : vertices) {
+        lo = glm::min(lo, v.position);
+        hi = glm::max(hi, v.position);
+    }
+
+    // Flat meshes have a zero extent along some axis. Any nonzero value
+    // quantizes them the same, a small one keeps the transform invertible.
+    glm::vec3 extent = hi - lo;
+    float largest = std::max({ extent.x, extent.y, extent.z });
+    float minimum = (largest > 0.0f) ? largest * 1e-4f : 1.0f;
+    boundsMin    = lo;
+    boundsExtent = glm::max(extent, glm::vec3(minimum));
+}
+
+glm::mat4 VIBufferBuilder::getDequantizeTransform() const {
+    if ((conf.vertexFormat & eVertexFlags_QuantizedPosition) == 0) {
+        return glm::mat4(1.0f);
+    }
+    return glm::scale(glm::translate(glm::mat4(1.0f), boundsMin), boundsExtent);
+}
+
+static uint32_t weld_index(uint32_t index, uint32_t vertexCount, const std::vector<uint32_t>& remap) {
+    return (index < vertexCount) ? remap[index] : index;
+}
+
+static uint32_t count_open_edges(const std::vector<AdjacentEdge>& edges) {
+    uint32_t count = 0;
+    for (const auto& adjacent : edges) {
+        count += adjacent.opposite.size() == 1;
+    }
+    return count;
+}
+
 void VIBufferBuilder::findEdges() {
+    using clock = std::chrono::steady_clock;
+
+    clock::duration hashedTime = {};
+    clock::duration sortedTime = {};
+    bool identical = true;
+
+    // Welding statistics.
+    uint32_t weldedVertices = 0;
+    uint32_t rawEdges       = 0;
+    uint32_t rawOpenEdges   = 0;
+    uint32_t outEdges       = 0;
+    uint32_t outOpenEdges   = 0;
+
     edges.clear();
     edges.resize(groups.size());
     for (uint32_t g = 0; g < groups.size(); ++g) {
         auto& group = groups[g];
-        const uint32_t* indices = reinterpret_cast<uint32_t*>(mappedStaging + group.indexOffset);
+        const uint32_t* rawIndices = indices.data() + group.firstIndex;
+        const uint32_t* edgeSource = rawIndices;
+        uint32_t        indexCount = group.indexCount;
 
-        // Reserve buckets to reduce the amount of rehashes. 
-        edges[g].reserve(group.indexCount);
+        // Point every index to the representative of its position.
+        // The index buffer used for drawing stays untouched.
+        if (conf.weld) {
+            const VertexNT* groupVertices = vertices.data() + group.vertexOffset;
+            uint32_t uniqueCount = welder.weld(groupVertices, group.vertexCount, conf.weldTolerance, weldRemap);
+            weldedVertices += group.vertexCount - uniqueCount;
 
-        for (uint32_t t = 0; t < group.indexCount; t += 3) {
-            uint32_t i0 = indices[t+0];
-            uint32_t i1 = indices[t+1];
-            uint32_t i2 = indices[t+2];
-            edges[g][Edge(i0, i1)].push_back(i2);
-            edges[g][Edge(i1, i2)].push_back(i0);
-            edges[g][Edge(i2, i0)].push_back(i1);
+            // Triangles that collapse after welding don't contribute
+            // to any silhouette and are left out.
+            weldedIndices.clear();
+            weldedIndices.reserve(group.indexCount);
+            for (uint32_t t = 0; t + 2 < group.indexCount; t += 3) {
+                uint32_t i0 = weld_index(rawIndices[t+0], group.vertexCount, weldRemap);
+                uint32_t i1 = weld_index(rawIndices[t+1], group.vertexCount, weldRemap);
+                uint32_t i2 = weld_index(rawIndices[t+2], group.vertexCount, weldRemap);
+                if (i0 != i1 && i1 != i2 && i2 != i0) {
+                    weldedIndices.insert(weldedIndices.end(), { i0, i1, i2 });
+                }
+            }
+            edgeSource = weldedIndices.data();
+            indexCount = uint32_t(weldedIndices.size());
         }
+
+        const auto build = [&](const uint32_t* source, uint32_t sourceCount, std::vector<AdjacentEdge>& out) {
+            switch (conf.edgeBuilder) {
+            default:
+            case eEdgeBuilder_Sorted:
+                adjacency.buildSorted(source, sourceCount, out);
+                break;
+            case eEdgeBuilder_Hashed:
+                adjacency.buildHashed(source, sourceCount, out);
+                break;
+            case eEdgeBuilder_Compare: {
+                // Run both and keep the sorted result.
+                std::vector<AdjacentEdge> reference;
+                auto t0 = clock::now();
+                adjacency.buildHashed(source, sourceCount, reference);
+                auto t1 = clock::now();
+                adjacency.buildSorted(source, sourceCount, out);
+                auto t2 = clock::now();
+                hashedTime += t1 - t0;
+                sortedTime += t2 - t1;
+                identical  &= AdjacencyBuilder::compare(reference, out);
+                break;
+            }
+            }
+        };
+
+        try {
+            build(edgeSource, indexCount, edges[g]);
+        } catch (const std::runtime_error&) {
+            // Welding can stack more triangles on an edge than the
+            // adjacency primitive can hold. Keep the seams in that case.
+            if (edgeSource == rawIndices) {
+                throw;
+            }
+            log += std::format("Mesh '{}': too many triangles share a welded edge, using unwelded edges.\n", name);
+            build(rawIndices, group.indexCount, edges[g]);
+        }
+
+        if (conf.weld && conf.weldStats) {
+            std::vector<AdjacentEdge> raw;
+            adjacency.buildSorted(rawIndices, group.indexCount, raw);
+            rawEdges     += uint32_t(raw.size());
+            rawOpenEdges += count_open_edges(raw);
+            outEdges     += uint32_t(edges[g].size());
+            outOpenEdges += count_open_edges(edges[g]);
+        }
+    }
+    weldRemap     = {};
+    weldedIndices = {};
+
+    if (conf.edgeBuilder == eEdgeBuilder_Compare) {
+        using ms = std::chrono::duration<double, std::milli>;
+        log += std::format("Edges of mesh '{}': hashed {:.3f} ms, sorted {:.3f} ms, output {}.\n",
+                           name,
+                           ms(hashedTime).count(),
+                           ms(sortedTime).count(),
+                           identical ? "identical" : "MISMATCH");
+    }
+
+    // Open edges have a single adjacent triangle, so the silhouette
+    // shader extrudes a volume quad from them for every light position.
+    if (conf.weld && conf.weldStats) {
+        log += std::format("Welding of mesh '{}': {} vertices merged, edges {} -> {} (-{}), "
+                           "open edges {} -> {} (-{} volume quads per light).\n",
+                           name,
+                           weldedVertices,
+                           rawEdges,     outEdges,     int64_t(rawEdges)     - outEdges,
+                           rawOpenEdges, outOpenEdges, int64_t(rawOpenEdges) - outOpenEdges);
+    }
+}
+
+static uint32_t edge_index_count(const AdjacentEdge& adjacent, bool compact) {
+    return (compact && adjacent.opposite.size() == 2) ? 4 : 6;
+}
+
+/// Returns true if the edge joins two coplanar triangles lying on opposite
+/// sides of it. Such an edge gets multiplicity 0 in the silhouette shader
+/// for any light position, so it never contributes to a shadow volume.
+static bool is_flat_edge(const AdjacentEdge& adjacent, const VertexNT* vertices, uint32_t vertexCount, double cosTolerance) {
+    if (adjacent.opposite.size() != 2) {
+        return false; // Border and non-manifold edges always stay.
+    }
+    const uint32_t ids[4] = { adjacent.edge.first, adjacent.edge.second, adjacent.opposite[0], adjacent.opposite[1] };
+    for (uint32_t id : ids) {
+        if (id >= vertexCount) {
+            return false;
+        }
+    }
+
+    const glm::dvec3 a (vertices[ids[0]].position);
+    const glm::dvec3 b (vertices[ids[1]].position);
+    const glm::dvec3 o0(vertices[ids[2]].position);
+    const glm::dvec3 o1(vertices[ids[3]].position);
+
+    // Both normals are oriented the same way relative to the edge, so
+    // they only agree if the triangles unfold into a plane.
+    const glm::dvec3 n0 = glm::cross(b - a, o0 - a);
+    const glm::dvec3 n1 = glm::cross(o1 - a, b - a);
+    const double     l0 = glm::length(n0);
+    const double     l1 = glm::length(n1);
+    if (l0 == 0.0 || l1 == 0.0) {
+        return false; // Degenerate triangles, don't guess.
+    }
+    if (cosTolerance >= 1.0) {
+        // Zero angle, only prune if the opposite vertex lies exactly in the plane.
+        return glm::dot(n0, o1 - a) == 0.0 && glm::dot(n0, n1) > 0.0;
+    }
+    return glm::dot(n0, n1) >= cosTolerance * l0 * l1;
+}
+
+void VIBufferBuilder::pruneEdges() {
+    const double cosTolerance = std::cos(glm::radians(double(conf.pruneAngle)));
+
+    uint32_t countBefore = 0;
+    uint32_t countAfter  = 0;
+    for (uint32_t g = 0; g < groups.size(); ++g) {
+        const auto&     group         = groups[g];
+        const VertexNT* groupVertices = vertices.data() + group.vertexOffset;
+
+        auto& groupEdges = edges[g];
+        for (const auto& adjacent : groupEdges) {
+            countBefore += edge_index_count(adjacent, conf.compactEdges);
+        }
+        std::erase_if(groupEdges, [&](const AdjacentEdge& adjacent) {
+            return is_flat_edge(adjacent, groupVertices, group.vertexCount, cosTolerance);
+        });
+        for (const auto& adjacent : groupEdges) {
+            countAfter += edge_index_count(adjacent, conf.compactEdges);
+        }
+    }
+
+    if (countAfter != countBefore) {
+        log += std::format("Edges of mesh '{}': pruned coplanar edges, edgeIndexCount {} -> {} (-{:.1f}%).\n",
+                           name,
+                           countBefore,
+                           countAfter,
+                           100.0 * (countBefore - countAfter) / countBefore);
     }
 }
 
 void VIBufferBuilder::unpackEdges() {
-    uint32_t  written = 0;
-    uint32_t* indices = reinterpret_cast<uint32_t*>(mappedStaging + ebOffset);
+    // Size the edge buffer exactly.
+    uint32_t edgeIndexCount = 0;
+    for (const auto& groupEdges : edges) {
+        for (const auto& adjacent : groupEdges) {
+            edgeIndexCount += edge_index_count(adjacent, conf.compactEdges);
+        }
+    }
+    edgeIndices.resize(edgeIndexCount);
+
+    uint32_t written = 0;
     for (uint32_t g = 0; g < groups.size(); ++g) {
-        auto& group   = groups[g];
-        auto& edgeMap = edges[g];
+        auto& group = groups[g];
 
         uint32_t prevWritten  = written;
-        group.edgeIndexOffset = ebOffset + written * sizeof(uint32_t);
-        for (auto& pair : edgeMap) {
-            const Edge& edge = pair.first;
-            indices[written++] = edge.first;
-            indices[written++] = edge.second;
+        group.firstEdgeIndex  = written;
+        for (const auto& adjacent : edges[g]) {
+            const Edge& edge = adjacent.edge;
+            const auto& oppositeVertices = adjacent.opposite;
+            if (conf.compactEdges && oppositeVertices.size() == 2) {
+                continue;
+            }
 
-            const auto& oppositeVertices = pair.second;
+            edgeIndices[written++] = edge.first;
+            edgeIndices[written++] = edge.second;
             for (uint32_t i = 0; i < 4; ++i) {
-                indices[written++] = (i < oppositeVertices.size())
-                                   ? oppositeVertices[i]
-                                   : edge.first; // Put invalid opposite vertex if not present.
+                edgeIndices[written++] = (i < oppositeVertices.size())
+                                       ? oppositeVertices[i]
+                                       : edge.first; // Put invalid opposite vertex if not present.
             }
         }
         group.edgeIndexCount = written - prevWritten;
+
+        prevWritten              = written;
+        group.firstEdgeLineIndex = written;
+        if (conf.compactEdges) {
+            for (const auto& adjacent : edges[g]) {
+                const Edge& edge = adjacent.edge;
+                const auto& oppositeVertices = adjacent.opposite;
+                if (oppositeVertices.size() != 2) {
+                    continue;
+                }
+
+                // Line with adjacency: the line itself is in the middle.
+                edgeIndices[written++] = oppositeVertices[0];
+                edgeIndices[written++] = edge.first;
+                edgeIndices[written++] = edge.second;
+                edgeIndices[written++] = oppositeVertices[1];
+            }
+        }
+        group.edgeLineIndexCount = written - prevWritten;
+    }
+    edges = {};
+}
+
+void VIBufferBuilder::buildMeshlets() {
+    for (auto& group : groups) {
+        const uint32_t* groupIndices = indices.data() + group.firstIndex;
+
+        group.firstMeshlet = uint32_t(meshlets.size());
+        group.meshletCount = 0;
+        bool valid = true;
+        for (uint32_t i = 0; valid && i < group.indexCount; ++i) {
+            valid = groupIndices[i] < group.vertexCount;
+        }
+        if (valid) {
+            group.meshletCount = meshletBuilder.build(groupIndices,
+                                                      group.indexCount,
+                                                      vertices.data() + group.vertexOffset,
+                                                      group.vertexCount,
+                                                      meshlets);
+        }
+    }
+}
+
+void VIBufferBuilder::packIndexStreams() {
+    const auto align4 = [](uint32_t bytes) { return (bytes + 3) & ~3u; };
+
+    // Groups that can address all of their vertices with 16 bits store
+    // both their draw and edge indices that way. Every group starts on
+    // a 4 byte boundary so that 16 and 32 bit groups can be mixed.
+    uint32_t indexBytes = 0;
+    uint32_t edgeBytes  = 0;
+    sources.resize(groups.size());
+    for (uint32_t g = 0; g < groups.size(); ++g) {
+        auto& group = groups[g];
+        sources[g] = { group.firstIndex, group.firstEdgeIndex };
+
+        bool narrow = group.vertexCount <= UINT16_MAX;
+        for (uint32_t i = 0; narrow && i < group.indexCount; ++i) {
+            narrow = indices[group.firstIndex + i] <= UINT16_MAX;
+        }
+        group.indexType = narrow ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+        const uint32_t size = index_type_size(group.indexType);
+
+        group.firstIndex = indexBytes / size;
+        indexBytes = align4(indexBytes + group.indexCount * size);
+
+        group.firstEdgeIndex     = edgeBytes / size;
+        group.firstEdgeLineIndex = group.firstEdgeIndex + group.edgeIndexCount;
+        edgeBytes = align4(edgeBytes + (group.edgeIndexCount + group.edgeLineIndexCount) * size);
     }
-}
\ No newline at end of file
+
+    ibSize   = indexBytes;
+    ebSize   = edgeBytes;
+    ebOffset = ibOffset + ibSize;
+}
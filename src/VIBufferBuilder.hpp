@@ -12,106 +12,133 @@
 /// (first edge vertex).
 /// Intended for access from the geometry shader.
 ///
+/// In compact mode, edges with exactly two adjacent triangles (the vast
+/// majority on closed meshes) are written to a separate "line list with
+/// adjacency" stream instead, encoded as (opposite 0, edge 0, edge 1,
+/// opposite 1). Only the remaining edges use the 6-index encoding.
+///
 #pragma once
 
 #include <stdexcept>
 #include "tiny_gltf_wrap.hpp"
 #include "GpuBuffer.hpp"
 #include "Vertex.hpp"
+#include "AdjacencyBuilder.hpp"
+#include "PositionWelder.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshletBuilder.hpp"
+#include "Configuration.hpp"
 
+// Offsets are in elements, relative to the start of the mesh data
+// as produced by VIBufferBuilder. Once the mesh is placed in a
+// GeometryArena, they can be used as firstIndex/vertexOffset directly.
+// Index offsets count elements of `indexType`, which applies to both the
+// draw and the edge index streams.
 struct VIBPrimGroup {
-    uint32_t materialID;
-    int32_t  vertexOffset;    // in bytes
-    int32_t  indexOffset;     // in bytes
-    int32_t  edgeIndexOffset; // in bytes
-    uint32_t vertexCount;
-    uint32_t indexCount;
-    uint32_t edgeIndexCount;
-};
-
-// Once std::inplace_vector becomes widely available with C++26, this structure
-// can be cut altogether.
-template<size_t max>
-struct OppositeVertices {
-    OppositeVertices() : count(0), data{} {}
-    ~OppositeVertices() = default;
-    void push_back(uint32_t index) {
-        if (count >= max) {
-            throw std::runtime_error("Too many opposite vertices.");
-        }
-        data[count++] = index;
-    }
-    void clear() {
-        count = 0;
-    }
-    uint32_t operator[](uint32_t index) const {
-        return data[index];
-    }
-    uint32_t  size()  const { return count;        }
-    uint32_t* begin()       { return &data[0];     }
-    uint32_t* end()         { return &data[count]; }
-
-    uint32_t count;
-    uint32_t data[max];
+    uint32_t    materialID;
+    VkIndexType indexType;
+    int32_t     vertexOffset;
+    uint32_t    firstIndex;
+    uint32_t    firstEdgeIndex;     // triangle list with adjacency
+    uint32_t    firstEdgeLineIndex; // line list with adjacency
+    uint32_t    vertexCount;
+    uint32_t    indexCount;
+    uint32_t    edgeIndexCount;
+    uint32_t    edgeLineIndexCount; // 0 unless compact edges are enabled
+    uint32_t    firstMeshlet;       // Into the meshlets of the mesh, or of the scene once loaded.
+    uint32_t    meshletCount;       // 0 if the group couldn't be split.
 };
 
-union Edge {
-    Edge(uint32_t f, uint32_t s)
-        : first(std::min(f, s)), second(std::max(f, s))
-    {}
-
-    uint32_t indices[2];
-    struct { uint32_t first, second; };
-    bool operator==(const Edge& other) const {
-        return (first == other.first  && second == other.second)
-            || (first == other.second && second == other.first);
-    }
-};
+inline uint32_t index_type_size(VkIndexType type) {
+    return (type == VK_INDEX_TYPE_UINT16) ? sizeof(uint16_t) : sizeof(uint32_t);
+}
 
-template<>
-struct std::hash<Edge> {
-    std::size_t operator()(const Edge& e) const {
-        // Keep commutative.
-        // Hash combination function taken from the boost library.
-        // (See: https://www.boost.org/doc/libs/1_43_0/doc/html/hash/reference.html#boost.hash_combine)
-        uint32_t first  = std::min(e.first, e.second);
-        uint32_t second = std::max(e.first, e.second);
-        return first ^ (second + 0x9e3779b9 + (first << 6) + (first >> 2));
-    }
+/// Mesh import options.
+struct VIBConf {
+    eEdgeBuilder edgeBuilder;
+    bool         weld;          // Build adjacency on welded positions.
+    float        weldTolerance; // 0 only welds exactly equal positions.
+    bool         weldStats;     // Print what welding removes per mesh.
+    bool         compactEdges;  // Put 2-face edges into a line list with adjacency.
+    bool         pruneEdges;    // Drop edges between coplanar faces.
+    float        pruneAngle;    // Max angle between face normals in degrees to count as coplanar.
+    eVertexFlags vertexFormat;  // Layout of the written vertex data.
+    bool         optimize;      // Reorder triangles and vertices for the GPU caches.
+    bool         geometryCache; // Load and store the output in a cache file next to the model.
 };
 
 /// Generates Vertex/Index buffer from a supplied tinygtlf mesh.
+/// The constructor only does CPU work, so several meshes can be built
+/// in parallel.
 class VIBufferBuilder {
 public:
-    VIBufferBuilder(Renderer& renderer, const tinygltf::Model& gltfModel, const tinygltf::Mesh& gltfMesh);
+    VIBufferBuilder(const tinygltf::Model& gltfModel, const tinygltf::Mesh& gltfMesh, const VIBConf& conf);
     VIBufferBuilder(VIBufferBuilder&&)      = delete;
     VIBufferBuilder(const VIBufferBuilder&) = delete;
 
-    GpuVertexIndexBuffer create();
+    /// Sizes of the vertex, position, index and edge index data in bytes.
+    uint32_t getVertexDataSize()   const { return vbSize; }
+    uint32_t getPositionDataSize() const { return pbSize; }
+    uint32_t getIndexDataSize()    const { return ibSize; }
+    uint32_t getEdgeDataSize()     const { return ebSize; }
+    uint32_t getBufferSize()       const { return vbSize + pbSize + ibSize + ebSize; }
 
-    std::vector<VIBPrimGroup> groups; // Public to be able to be moved by the user.
+    /// Maps quantized positions back to mesh space, to be applied before
+    /// the node transform. Identity unless positions are quantized.
+    glm::mat4 getDequantizeTransform() const;
+
+    /// Writes vertex, position, index and edge index data back to back,
+    /// getBufferSize() bytes in total. The positions are a tightly packed
+    /// copy of the ones in the vertices, for passes that need nothing else.
+    void writeBufferData(void* dst) const;
+
+    /// Stats and warnings collected while building, to be printed by the
+    /// caller so that the output of parallel builds doesn't interleave.
+    const std::string& getLog() const { return log; }
+
+    std::vector<VIBPrimGroup> groups;   // Public to be able to be moved by the user.
+    std::vector<MeshletData>  meshlets; // Same here.
 private:
-    uint32_t calcStagingSize(const tinygltf::Model& gltfModel, const tinygltf::Mesh& gltfMesh);
+    void     calcBufferLayout(const tinygltf::Model& gltfModel, const tinygltf::Mesh& gltfMesh);
     void     readVertices(const tinygltf::Model& gltfModel, const tinygltf::Mesh& gltfMesh);
     void     readIndices(const tinygltf::Model& gltfModel, const tinygltf::Mesh& gltfMesh);
+    void     calcBounds();
+    void     optimizeGroups();
     void     findEdges();
+    void     pruneEdges();
     void     unpackEdges();
+    void     buildMeshlets();
+    void     packIndexStreams();
 
-    // Limiting ourselves to a maximum amount of opposite vertices
-    // to avoid an overhead of having to manage dynamic arrays for each edge.
-    // The maximum we can pass to the geometry shader via the "triangle with adjacency"
-    // primitive is 4, hence the maximum amount here.
-    std::vector<std::unordered_map<Edge, OppositeVertices<4>>> edges;
+    std::vector<std::vector<AdjacentEdge>> edges;
+    AdjacencyBuilder                       adjacency;
+    PositionWelder                         welder;
+    MeshOptimizer                          optimizer;
+    MeshletBuilder                         meshletBuilder;
+    std::vector<uint32_t>                  weldRemap;
+    std::vector<uint32_t>                  weldedIndices;
 
-    Renderer&        renderer;
-    uint32_t         totalVertexCount;
-    uint32_t         totalIndexCount;
-    uint32_t         totalEdgeIndexCount;
-    uint32_t         vbOffset, ibOffset, ebOffset;
-    uint32_t         vbSize, ibSize, ebSize;
-    uint32_t         stagingBufferSize;
-    GpuStagingBuffer staging;
-    uint8_t*         mappedStaging;
-    VertexNT*        stgVertices;
-    uint32_t*        stgIndices;
-};
+    // CPU-side copies of the buffer contents, packed by writeBufferData()
+    // into the caller's staging memory once the amount of edges is known.
+    std::vector<VertexNT> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> edgeIndices;
+
+    // Where the indices of each group start in the vectors above. The
+    // offsets in the groups themselves refer to the packed output.
+    struct GroupSource {
+        uint32_t firstIndex;
+        uint32_t firstEdgeIndex;
+    };
+    std::vector<GroupSource> sources;
+
+    VIBConf     conf;
+    std::string name;
+    std::string log;
+    uint32_t    totalVertexCount;
+    uint32_t    totalIndexCount;
+    uint32_t    vbOffset, pbOffset, ibOffset, ebOffset;
+    uint32_t    vbSize, pbSize, ibSize, ebSize;
+    glm::vec3   boundsMin;
+    glm::vec3   boundsExtent; // Never 0, so that it can be inverted.
+};
\ No newline at end of file
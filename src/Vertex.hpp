@@ -24,6 +24,14 @@
 ///         vec4 color;                    // location 3
 /// };
 ///
+/// The Packed and QuantizedPosition bits don't add attributes, they change
+/// how the existing ones are stored (see VertexPackedNT/VertexQuantizedNT):
+///   - Packed: normals as octahedral snorm16x2, texcoords as half2 and
+///     colors as unorm8x4.
+///   - QuantizedPosition: positions as unorm16x4 relative to the AABB of
+///     the mesh. The shader sees them in [0, 1], the dequantization is
+///     left to the transform matrix.
+///
 #pragma once
 
 #include "glm.hpp"
@@ -35,6 +43,9 @@ enum eVertexFlags {
     eVertexFlags_Normal   = (1 << 0),
     eVertexFlags_TexCoord = (1 << 1),
     eVertexFlags_Color    = (1 << 2),
+
+    eVertexFlags_Packed            = (1 << 3),
+    eVertexFlags_QuantizedPosition = (1 << 4),
 };
 
 inline eVertexFlags operator|( eVertexFlags a, eVertexFlags b ) {
@@ -69,4 +80,33 @@ typedef VERTEX_TYPE(N,T,C) VertexNTC; // position, normal, texcoord, color
 #undef N
 #undef T
 #undef C
-#undef VERTEX_TYPE
\ No newline at end of file
+#undef VERTEX_TYPE
+
+/// VertexNT with eVertexFlags_Packed, 20 bytes.
+struct VertexPackedNT {
+    glm::vec3 position;
+    int16_t   normal[2];   // Octahedral encoding
+    uint16_t  texCoord[2]; // Half float
+};
+
+/// VertexNT with eVertexFlags_Packed|eVertexFlags_QuantizedPosition, 16 bytes.
+struct VertexQuantizedNT {
+    uint16_t position[4]; // w is unused
+    int16_t  normal[2];
+    uint16_t texCoord[2];
+};
+
+/// Size of the position alone, as stored in position-only streams.
+inline uint32_t position_size(eVertexFlags flags) {
+    return (flags & eVertexFlags_QuantizedPosition) ? 4 * sizeof(uint16_t) : sizeof(glm::vec3);
+}
+
+/// Size of the vertex structure described by the flags.
+inline uint32_t vertex_size(eVertexFlags flags) {
+    const bool packed = (flags & eVertexFlags_Packed) != 0;
+    uint32_t size = position_size(flags);
+    if (flags & eVertexFlags_Normal)   { size += packed ? 2 * sizeof(int16_t)  : sizeof(glm::vec3); }
+    if (flags & eVertexFlags_TexCoord) { size += packed ? 2 * sizeof(uint16_t) : sizeof(glm::vec2); }
+    if (flags & eVertexFlags_Color)    { size += packed ? 4 * sizeof(uint8_t)  : sizeof(glm::vec4); }
+    return size;
+}
\ No newline at end of file
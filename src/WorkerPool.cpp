@@ -0,0 +1,127 @@
+///
+/// Vulkan Shadows
+/// Author: Fedor Vorobev
+///
+/// Persistent pool of worker threads for splitting CPU-heavy loading work.
+///
+#include <algorithm>
+#include "WorkerPool.hpp"
+
+thread_local bool WorkerPool::insideJob = false;
+
+WorkerPool::WorkerPool(uint32_t threadCount)
+    : stopping(false)
+    , generation(0)
+    , activeWorkers(0)
+    , job(nullptr)
+    , jobCount(0)
+    , nextIndex(0)
+    , pending(0)
+{
+    for (uint32_t i = 1; i < threadCount; ++i) {
+        threads.emplace_back(&WorkerPool::workerLoop, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeCv.notify_all();
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+WorkerPool& WorkerPool::get() {
+    static WorkerPool pool(std::max(1u, std::thread::hardware_concurrency()));
+    return pool;
+}
+
+void WorkerPool::run(uint32_t count, const std::function<void(uint32_t)>& fn) {
+    if (count == 0) {
+        return;
+    }
+    if (insideJob || threads.empty() || count == 1) {
+        for (uint32_t i = 0; i < count; ++i) {
+            fn(i);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> runLock(runMutex);
+    {
+        // Workers that woke up late for the previous job might still be
+        // looking at its counters, so wait for them to leave first.
+        std::unique_lock<std::mutex> lock(mutex);
+        doneCv.wait(lock, [this] { return activeWorkers == 0; });
+        job       = &fn;
+        jobCount  = count;
+        nextIndex = 0;
+        pending   = count;
+        error     = nullptr;
+        generation++;
+    }
+    wakeCv.notify_all();
+
+    // The calling thread helps out instead of just waiting.
+    insideJob = true;
+    executeJobs();
+    insideJob = false;
+
+    std::exception_ptr jobError;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        doneCv.wait(lock, [this] { return pending == 0; });
+        job      = nullptr;
+        jobError = error;
+        error    = nullptr;
+    }
+    if (jobError) {
+        std::rethrow_exception(jobError);
+    }
+}
+
+void WorkerPool::executeJobs() {
+    while (true) {
+        uint32_t i = nextIndex.fetch_add(1);
+        if (i >= jobCount) {
+            break;
+        }
+        try {
+            (*job)(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+        if (pending.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lock(mutex);
+            doneCv.notify_all();
+        }
+    }
+}
+
+void WorkerPool::workerLoop() {
+    insideJob = true;
+    uint64_t seenGeneration = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeCv.wait(lock, [&] { return stopping || generation != seenGeneration; });
+            if (stopping) {
+                return;
+            }
+            seenGeneration = generation;
+            activeWorkers++;
+        }
+        executeJobs();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            activeWorkers--;
+        }
+        doneCv.notify_all();
+    }
+}
@@ -0,0 +1,63 @@
+///
+/// Vulkan Shadows
+/// Author: Fedor Vorobev
+///
+/// Persistent pool of worker threads for splitting CPU-heavy loading work.
+///
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool {
+public:
+    /// Creates a pool that runs jobs on `threadCount` threads in total,
+    /// the thread calling run() included.
+    WorkerPool(uint32_t threadCount);
+    ~WorkerPool();
+
+    /// Copying not allowed.
+    WorkerPool(const WorkerPool&) = delete;
+
+    /// Moving not allowed.
+    WorkerPool(WorkerPool&&) = delete;
+
+    /// Returns the process-wide pool sized to the amount of hardware threads.
+    static WorkerPool& get();
+
+    /// Calls fn(i) for every i in [0, count) using all threads of the pool
+    /// and blocks until every call returns. The first exception thrown by
+    /// any of the calls is rethrown here.
+    /// Calls made from inside a job are executed serially on the calling
+    /// thread to avoid deadlocking the pool.
+    void run(uint32_t count, const std::function<void(uint32_t)>& fn);
+
+    /// Amount of threads jobs are spread across.
+    uint32_t getThreadCount() const { return uint32_t(threads.size()) + 1; }
+private:
+    void workerLoop();
+    void executeJobs();
+
+    static thread_local bool insideJob;
+
+    std::vector<std::thread> threads;
+    std::mutex               runMutex;
+    std::mutex               mutex;
+    std::condition_variable  wakeCv;
+    std::condition_variable  doneCv;
+    bool                     stopping;
+    uint64_t                 generation;
+    uint32_t                 activeWorkers;
+
+    const std::function<void(uint32_t)>* job;
+    uint32_t                             jobCount;
+    std::atomic<uint32_t>                nextIndex;
+    std::atomic<uint32_t>                pending;
+    std::exception_ptr                   error;
+};
@@ -25,9 +25,19 @@
 static const char* shadow_tech_names[] = {
     "No Shadows",
     "Shadow Mapping",
-    "Stencil Shadow Volumes"
+    "Stencil Shadow Volumes",
+    "Dual-Paraboloid Shadow Mapping",
+    "Tetrahedral Shadow Mapping",
 };
 
+static eOmniShadowMap omni_shadow_map(eShadowTech tech) {
+    switch (tech) {
+    case eShadowTech_DualParaboloid: return eOmniShadowMap_DualParaboloid;
+    case eShadowTech_Tetrahedral:    return eOmniShadowMap_Tetrahedral;
+    default:                         return eOmniShadowMap_Cube;
+    }
+}
+
 static const char* sv_method_names[] = {
     "Depth Pass",
     "Depth Fail",
@@ -106,6 +116,24 @@ static VkDescriptorPool create_imgui_descpool(Renderer& renderer) {
     return pool;
 }
 
+/// Turns off the options that need device features the renderer
+/// couldn't enable.
+static void disable_unsupported_options(Configuration& conf, const OptionalFeatures& features) {
+    if (!features.indirectCount && (conf.indirectDraws || conf.gpuCulling)) {
+        std::cout << "Indirect count draws aren't supported by the device, indirect draws and GPU culling are turned off.\n";
+        conf.indirectDraws = false;
+        conf.gpuCulling    = false;
+    }
+    if (!features.multiview && conf.smMultiview) {
+        std::cout << "Multiview isn't supported by the device, cube shadow map faces are drawn one at a time.\n";
+        conf.smMultiview = false;
+    }
+    if (!features.clipDistance && conf.shadowTech == eShadowTech_DualParaboloid) {
+        std::cout << "Clip distances aren't supported by the device, falling back to cube shadow maps.\n";
+        conf.shadowTech = eShadowTech_ShadowMapping;
+    }
+}
+
 ///
 /// The program's entry point.
 ///
@@ -127,17 +155,36 @@ int main(int argc, char* argv[]) {
         .needTimestamps = conf.test,
     };
     Renderer renderer("Vulkan Shadows", gfxsettings);
+    disable_unsupported_options(conf, renderer.getOptionalFeatures());
 
     VkDescriptorPool imguiDescriptorPool = create_imgui_descpool(renderer);
     init_imgui(renderer, imguiDescriptorPool);
 
     CommonSamplers samplers(renderer);
     BindlessSet    bindlessSet(renderer);
-    ScenePipelines scenePipelines(renderer, bindlessSet.getLayout());
+    ScenePipelines scenePipelines(renderer, bindlessSet.getLayout(), conf.vertexFormat);
     bindlessSet.setSamplerIndex(eSampler_Linear,  samplers.linear);
     bindlessSet.setSamplerIndex(eSampler_Nearest, samplers.nearest);
 
-    Scene scene(renderer, scenePipelines, conf.filename);
+    VIBConf meshConf = {
+        .edgeBuilder   = conf.edgeBuilder,
+        .weld          = conf.weld,
+        .weldTolerance = conf.weldTolerance,
+        .weldStats     = conf.weldStats,
+        .compactEdges  = conf.compactEdges,
+        .pruneEdges    = conf.pruneEdges,
+        .pruneAngle    = conf.pruneAngle,
+        .vertexFormat  = conf.vertexFormat,
+        .optimize      = conf.optimizeMeshes,
+        // The stats are printed while building, so don't skip it then.
+        .geometryCache = conf.geometryCache && !conf.weldStats && conf.edgeBuilder != eEdgeBuilder_Compare,
+    };
+    GeometryArena geometry(renderer, vertex_size(conf.vertexFormat), position_size(conf.vertexFormat));
+    auto scene = std::make_unique<Scene>(renderer, scenePipelines, geometry, conf.filename, meshConf);
+    scene->indirectDraws = conf.indirectDraws;
+    scene->gpuCulling    = conf.gpuCulling;
+    scene->shadowMapCaching = conf.smCache;
+    scene->shadowFaceBudget = uint32_t(conf.smFaceBudget);
 
     Scene::LightData startLight = {
         .position  = conf.lightPosition,
@@ -147,11 +194,11 @@ int main(int argc, char* argv[]) {
         .diffuse   = conf.lightDiffuse
     };
 
-    if (!conf.lightIgnoreNode && scene.lightNodeID >= 0) {
+    if (!conf.lightIgnoreNode && scene->lightNodeID >= 0) {
         // Extract the light position from the scene if it's present.
-        startLight.position = glm::vec3(scene.getNodeTransform(scene.lightNodeID)[3]);
+        startLight.position = glm::vec3(scene->getNodeTransform(scene->lightNodeID)[3]);
     }
-    scene.lights.push_back(startLight);
+    scene->lights.push_back(startLight);
 
     Camera camera = {
         .moveSpeed   = 1.0f,
@@ -163,9 +210,9 @@ int main(int argc, char* argv[]) {
         .target      = conf.cameraTarget,
     };
 
-    if (!conf.cameraIgnoreNode && scene.cameraNodeID >= 0) {
+    if (!conf.cameraIgnoreNode && scene->cameraNodeID >= 0) {
         // Place camera in place of the node in the scene if there is one.
-        camera.fromTransformMatrix(scene.getNodeTransform(scene.cameraNodeID));
+        camera.fromTransformMatrix(scene->getNodeTransform(scene->cameraNodeID));
     }
 
     int   resolutionSelection = 2; // 512
@@ -173,6 +220,7 @@ int main(int argc, char* argv[]) {
     bool  mouseCaptured       = false;
     bool  followCameraNode    = conf.test;
     bool  followLightNode     = !conf.lightIgnoreNode;
+    bool  reloadScene         = false;
 
     const Uint8* keyboard = SDL_GetKeyboardState(nullptr);
 
@@ -184,6 +232,13 @@ int main(int argc, char* argv[]) {
     Uint64 pcLast    = 0;
     Uint64 pcNow     = SDL_GetPerformanceCounter();
 
+    // Shadow map totals of the test, averaged at the end to compare the
+    // techniques between runs.
+    uint64_t testShadowPasses    = 0;
+    uint64_t testShadowTriangles = 0;
+    double   testShadowTime      = 0;
+    double   testFrameTime       = 0;
+
     ImGuiIO& io = ImGui::GetIO();
     while (running) {
         if (conf.test && frames >= conf.testFrames) {
@@ -192,6 +247,28 @@ int main(int argc, char* argv[]) {
             break;
         }
 
+        if (reloadScene) {
+            reloadScene = false;
+            renderer.waitForDevice();
+            try {
+                // Load first so that the old scene stays if that fails. Its
+                // ranges are freed afterwards, leaving holes at the front
+                // of the arena that compaction closes.
+                auto loaded = std::make_unique<Scene>(renderer, scenePipelines, geometry, conf.filename, meshConf);
+                loaded->frustumCulling   = scene->frustumCulling;
+                loaded->indirectDraws    = scene->indirectDraws;
+                loaded->gpuCulling       = scene->gpuCulling;
+                loaded->shadowMapCaching = scene->shadowMapCaching;
+                loaded->shadowFaceBudget = scene->shadowFaceBudget;
+                loaded->lights           = scene->lights;
+                scene = std::move(loaded);
+                geometry.compact();
+                scene->relocateGeometry();
+            } catch (const std::exception& ex) {
+                std::cout << std::format("Couldn't reload the scene: {}\n", ex.what());
+            }
+        }
+
         Sint32 mouseXRel = 0;
         Sint32 mouseYRel = 0;
         while (SDL_PollEvent(&e)) {
@@ -247,12 +324,12 @@ int main(int argc, char* argv[]) {
         VkExtent2D extent = renderer.getSwapchain().getExtent();
         
         camera.aspectRatio = float(extent.width) / float(extent.height);
-        if (followCameraNode && scene.cameraNodeID >= 0) {
-            camera.fromTransformMatrix(scene.getNodeTransform(scene.cameraNodeID));
+        if (followCameraNode && scene->cameraNodeID >= 0) {
+            camera.fromTransformMatrix(scene->getNodeTransform(scene->cameraNodeID));
         } else if (mouseCaptured) {
             camera.updateControlled(deltaTime, keyboard, mouseXRel, mouseYRel);
         }
-        camera.copyToSceneCameraBuffer(scene);
+        camera.copyToSceneCameraBuffer(*scene);
         
         if (showUI) {
             ImGui::Begin("Inspector");
@@ -266,22 +343,48 @@ int main(int argc, char* argv[]) {
                         camera.target.z);
             ImGui::Separator();
 
-            if (scene.lightNodeID > 0) {
+            if (scene->lightNodeID > 0) {
                 ImGui::Checkbox("Follow scene's light node", &followLightNode);
             } else {
                 followLightNode = false;
-                ImGui::Text("No light node in the scene.");
+                ImGui::Text("No light node in the scene->");
             }
 
-            if (scene.cameraNodeID > 0) {
+            if (scene->cameraNodeID > 0) {
                 ImGui::Checkbox("Follow scene's camera node", &followCameraNode);
             } else {
                 followCameraNode = false;
-                ImGui::Text("No camera node in the scene.");
+                ImGui::Text("No camera node in the scene->");
             }
 
             ImGui::Separator();
-            ImGui::Combo("Shadowing Technique", (int*) &conf.shadowTech, shadow_tech_names, ARRAY_COUNT(shadow_tech_names));
+            if (ImGui::Button("Reload scene")) {
+                reloadScene = true;
+            }
+            ImGui::Text("Geometry arena: %.1f MiB used of %.1f MiB",
+                        geometry.getUsedSize()     / (1024.0 * 1024.0),
+                        geometry.getCapacitySize() / (1024.0 * 1024.0));
+            if (renderer.getOptionalFeatures().indirectCount) {
+                ImGui::Checkbox("Indirect draws (with GPU culling only)", &scene->indirectDraws);
+                ImGui::Checkbox("GPU culling", &scene->gpuCulling);
+            } else {
+                ImGui::Text("Indirect draws and GPU culling aren't supported by the device.");
+            }
+            ImGui::Checkbox("Frustum culling", &scene->frustumCulling);
+            // Indirect draws are culled on the GPU, the CPU doesn't see how many.
+            const bool gpuCulled = scene->indirectDraws && scene->gpuCulling;
+            if (gpuCulled) {
+                ImGui::Text("Scene draws: %u indirect commands, culled on the GPU", scene->drawStats.drawn);
+            } else {
+                ImGui::Text("Scene draws: %u drawn, %u culled", scene->drawStats.drawn, scene->drawStats.culled);
+            }
+            ImGui::Separator();
+            // The shadow maps are made for one of the layouts.
+            if (ImGui::Combo("Shadowing Technique", (int*) &conf.shadowTech, shadow_tech_names, ARRAY_COUNT(shadow_tech_names))) {
+                disable_unsupported_options(conf, renderer.getOptionalFeatures());
+                renderer.waitForDevice();
+                scene->shadowMaps.clear();
+            }
             ImGui::Separator();
 
             switch (conf.shadowTech) {
@@ -289,6 +392,8 @@ int main(int argc, char* argv[]) {
                 ImGui::Text("No options for shadowless mode.");
                 break;
             case eShadowTech_ShadowMapping:
+            case eShadowTech_DualParaboloid:
+            case eShadowTech_Tetrahedral:
                 ImGui::Text("Shadow mapping configuration:");
                 ImGui::Text("Used VkFormat for the shadow map: %s", string_VkFormat(renderer.getBestDepthFormat()));
                 ImGui::Combo("Cube Shadow Map Face Resolution", &resolutionSelection, shadow_map_resolution_names, ARRAY_COUNT(shadow_map_resolution_names));
@@ -297,6 +402,41 @@ int main(int argc, char* argv[]) {
                 ImGui::InputFloat("Depth Bias Slope Factor", &conf.smBiasSlope, 0, 0, "%.8f");
                 ImGui::DragFloat("Depth Near", &conf.smZNear, 0.001f);
                 ImGui::Checkbox("Use PCF shadow sampler", &conf.smPCFSampler);
+                ImGui::Checkbox("Only redraw shadow map faces that changed", &scene->shadowMapCaching);
+                if (conf.shadowTech == eShadowTech_ShadowMapping) {
+                    // The maps are made for one of the modes, same as with resolutions.
+                    if (renderer.getOptionalFeatures().multiview &&
+                        ImGui::Checkbox("Draw all cube faces in one multiview pass", &conf.smMultiview))
+                    {
+                        renderer.waitForDevice();
+                        scene->shadowMaps.clear();
+                    }
+                    ImGui::Checkbox("Keep static casters in a separate layer", &conf.smStaticLayer);
+                    // Same as above, the atlas replaces the cube maps.
+                    if (ImGui::Checkbox("Draw all lights to one shadow atlas", &conf.smAtlas)) {
+                        renderer.waitForDevice();
+                        scene->shadowMaps.clear();
+                    }
+                    if (conf.smAtlas) {
+                        ImGui::Text("Shadow atlas: %.1f%% used", scene->drawStats.atlasUsage * 100.0f);
+                    }
+                }
+                ImGui::DragScalar("Changed faces drawn per frame (0 for all)", ImGuiDataType_U32, &scene->shadowFaceBudget, 0.1f);
+                if (gpuCulled) {
+                    ImGui::Text("Shadow map draws: %u indirect commands, culled on the GPU", scene->drawStats.shadowDrawn);
+                } else {
+                    ImGui::Text("Shadow map draws: %u drawn, %u culled", scene->drawStats.shadowDrawn, scene->drawStats.shadowCulled);
+                }
+                ImGui::Text("Shadow map faces: %u lights skipped, %u faces cached, %u deferred",
+                            scene->drawStats.skippedLights,
+                            scene->drawStats.cachedFaces,
+                            scene->drawStats.deferredFaces);
+                ImGui::Text("Shadow map passes: %u, %llu triangles",
+                            scene->drawStats.shadowPasses,
+                            (unsigned long long) scene->drawStats.shadowTriangles);
+                for (uint32_t l = 0; l < scene->lights.size(); ++l) {
+                    ImGui::Text("Light %u: out of date for %u frames", l, scene->getShadowMapStaleness(l));
+                }
 
                 // Handle switching shadow map resolutions by deleting the
                 // previous shadow map textures and making the Scene class
@@ -304,7 +444,7 @@ int main(int argc, char* argv[]) {
                 if (shadow_map_resolutions[resolutionSelection] != conf.smResolution) {
                     conf.smResolution = shadow_map_resolutions[resolutionSelection];
                     renderer.waitForDevice();
-                    scene.shadowMaps.clear();
+                    scene->shadowMaps.clear();
                 }
                 break;
             case eShadowTech_StencilShadowVolumes:
@@ -314,38 +454,50 @@ int main(int argc, char* argv[]) {
             }
 
             ImGui::Separator();
-            ImGui::InputFloat3("Light Position", &scene.lights[0].position.x);
-            ImGui::ColorEdit3("Ambient Color",   &scene.lights[0].ambient.x);
-            ImGui::ColorEdit3("Diffuse Color",   &scene.lights[0].diffuse.x);
-            ImGui::DragFloat("Range",            &scene.lights[0].range,     0.1f);
-            ImGui::DragFloat("Intensity",        &scene.lights[0].intensity, 0.1f);
+            ImGui::InputFloat3("Light Position", &scene->lights[0].position.x);
+            ImGui::ColorEdit3("Ambient Color",   &scene->lights[0].ambient.x);
+            ImGui::ColorEdit3("Diffuse Color",   &scene->lights[0].diffuse.x);
+            ImGui::DragFloat("Range",            &scene->lights[0].range,     0.1f);
+            ImGui::DragFloat("Intensity",        &scene->lights[0].intensity, 0.1f);
             ImGui::End();
 
             // Display the guizmo for the light if we have control over it.
             if (!followLightNode) {
                 ImGuizmo::SetRect(0, 0, io.DisplaySize.x, io.DisplaySize.y);
-                glm::mat4 lightMatrix = glm::translate(glm::mat4(1), scene.lights[0].position);
+                glm::mat4 lightMatrix = glm::translate(glm::mat4(1), scene->lights[0].position);
                 ImGuizmo::Manipulate(&camera.view[0][0],
                                      &camera.projection[0][0],
                                      ImGuizmo::TRANSLATE,
                                      ImGuizmo::WORLD,
                                      &lightMatrix[0][0]);
-                scene.lights[0].position = glm::vec3(lightMatrix[3]);
+                scene->lights[0].position = glm::vec3(lightMatrix[3]);
             }
         }
 
-        scene.shadowMapConf = {
+        scene->shadowMapConf = {
             .resolution     = uint32_t(conf.smResolution),
             .cullFrontFaces = conf.smCullFrontFaces,
             .biasConstant   = conf.smBiasConstant,
             .biasSlope      = conf.smBiasSlope,
-            .zNear          = conf.smZNear
+            .zNear          = conf.smZNear,
+            .multiview      = conf.smMultiview,
+            .staticLayer    = conf.smStaticLayer,
+            .atlas          = conf.smAtlas,
+            .atlasSize      = uint32_t(conf.smAtlasSize),
+            .omni           = omni_shadow_map(conf.shadowTech),
         };
+        // Only the cube maps come in these variants.
+        if (scene->shadowMapConf.omni != eOmniShadowMap_Cube) {
+            scene->shadowMapConf.multiview   = false;
+            scene->shadowMapConf.staticLayer = false;
+            scene->shadowMapConf.atlas       = false;
+        }
 
-        if (followLightNode && scene.lightNodeID >= 0) {
-            scene.lights[0].position = glm::vec3(scene.getNodeTransform(scene.lightNodeID)[3]); // Extract position
+        if (followLightNode && scene->lightNodeID >= 0) {
+            scene->lights[0].position = glm::vec3(scene->getNodeTransform(scene->lightNodeID)[3]); // Extract position
         }
 
+        scene->drawStats = {}; // The inspector above shows the previous frame.
         renderer.getSwapchain().recordFrame([&](Swapchain& swapchain, VkCommandBuffer cmdbuf) {
             const auto vkset = bindlessSet.getSet();
             vkCmdBindDescriptorSets(cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, scenePipelines.layout, 0, 1, &vkset, 0, nullptr);
@@ -355,14 +507,19 @@ int main(int argc, char* argv[]) {
             } else {
                 bindlessSet.setSamplerIndex(eSampler_Shadow, samplers.shadow);
             }
-            scene.fillOutBindlessSet(bindlessSet);
+            scene->fillOutBindlessSet(bindlessSet);
 
             // Shadow Map render pass if necessary.
-            if (conf.shadowTech == eShadowTech_ShadowMapping) {
-                scene.recordDrawBufferUpdates(cmdbuf);
-                scene.drawToShadowMaps(cmdbuf, bindlessSet);
+            if (is_shadow_mapping(conf.shadowTech)) {
+                scene->recordDrawBufferUpdates(cmdbuf);
+                swapchain.beginShadowTimer();
+                scene->drawToShadowMaps(cmdbuf, bindlessSet);
+                swapchain.endShadowTimer();
+            } else {
+                scene->skipShadowMaps();
             }
-            scene.recordDrawBufferUpdates(cmdbuf);
+            scene->recordDrawBufferUpdates(cmdbuf);
+            scene->recordCulling(cmdbuf);
 
             // Swapchain renderpass
             swapchain.beginRenderPass();
@@ -370,17 +527,19 @@ int main(int argc, char* argv[]) {
 
             switch (conf.shadowTech) {
             case eShadowTech_None:
-                scene.recordScene(cmdbuf);
+                scene->recordScene(cmdbuf);
                 break;
             case eShadowTech_ShadowMapping:
-                scene.recordScene(cmdbuf, eScenePipelineFlags_Depth, eSceneDrawType_ShadowMapped);
+            case eShadowTech_DualParaboloid:
+            case eShadowTech_Tetrahedral:
+                scene->recordScene(cmdbuf, eScenePipelineFlags_Depth, eSceneDrawType_ShadowMapped);
                 break;
             case eShadowTech_StencilShadowVolumes:
-                scene.recordScene(cmdbuf, eScenePipelineFlags_Depth, eSceneDrawType_Ambient);
-                scene.recordShadowVolumesStencil(cmdbuf, conf.svMethod, 0);
-                scene.recordScene(cmdbuf, 0, eSceneDrawType_DiffuseStencilTested);
+                scene->recordScene(cmdbuf, eScenePipelineFlags_Depth, eSceneDrawType_Ambient);
+                scene->recordShadowVolumesStencil(cmdbuf, conf.svMethod, 0);
+                scene->recordScene(cmdbuf, 0, eSceneDrawType_DiffuseStencilTested);
                 if (conf.svDebugOverlay) {
-                    scene.recordSilhoutteDebugOverlay(cmdbuf, 0);
+                    scene->recordSilhoutteDebugOverlay(cmdbuf, 0);
                 }
                 break;
             }
@@ -389,7 +548,13 @@ int main(int argc, char* argv[]) {
             ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmdbuf);
             vkCmdEndRenderPass(cmdbuf);
         });
-        scene.advanceAnimations(conf.test ? conf.testTimeStep : deltaTime, true);
+        scene->advanceAnimations(conf.test ? conf.testTimeStep : deltaTime, true);
+        if (conf.test) {
+            testShadowPasses    += scene->drawStats.shadowPasses;
+            testShadowTriangles += scene->drawStats.shadowTriangles;
+            testShadowTime      += renderer.getSwapchain().getShadowTime();
+            testFrameTime       += renderer.getSwapchain().getFrameTime();
+        }
         
         // Adjust deltaTime.
         pcLast    = pcNow;
@@ -402,6 +567,16 @@ int main(int argc, char* argv[]) {
     // resources the GPU might still be using.
     renderer.waitForDevice();
 
+    if (conf.test && is_shadow_mapping(conf.shadowTech) && frames > 0) {
+        std::cout << std::format("{}: {:.2f} passes, {:.0f} triangles, {:.3f} ms shadow maps, {:.3f} ms frame (GPU, per frame over {} frames)\n",
+                                 shadow_tech_names[conf.shadowTech],
+                                 double(testShadowPasses) / frames,
+                                 double(testShadowTriangles) / frames,
+                                 testShadowTime / frames,
+                                 testFrameTime / frames,
+                                 frames);
+    }
+
     ImGui_ImplVulkan_Shutdown();
     ImGui_ImplSDL2_Shutdown();
     ImGui::DestroyContext();
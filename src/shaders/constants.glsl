@@ -10,5 +10,6 @@ layout (constant_id = 0) const uint ENABLE_ALPHA_TEST = 0U;
 layout (constant_id = 1) const uint USE_SHADOW_MAPS   = 0U;
 layout (constant_id = 2) const uint OUTPUT_AMBIENT    = 0U;
 layout (constant_id = 3) const uint OUTPUT_DIFFUSE    = 0U;
+layout (constant_id = 4) const uint PACKED_NORMALS    = 0U; // Octahedral snorm16x2 normals
 
 #endif 
\ No newline at end of file
@@ -27,7 +27,77 @@ struct LightResult {
     vec3 diffuse;
 };
 
-float getShadowFactor(vec4 pos, Light light) {
+// Samples the tile of a face at a position projected by it.
+float sampleShadowTile(Light light, uint face, vec3 ndc) {
+    vec4 rect = light.atlasRects[face];
+    vec2 uv   = rect.zw + (ndc.xy * 0.5 + 0.5) * rect.xy;
+
+    // Filtering mustn't reach into the neighbouring tiles.
+    vec2 halfTexel = 0.5 / textureSize2D(light.shadowMap);
+    uv = clamp(uv, rect.zw + halfTexel, rect.zw + rect.xy - halfTexel);
+    return sampleTexture2DShadow(light.shadowMap, ShadowSampler, vec3(uv, ndc.z));
+}
+
+// Same as below with the faces in tiles of the shadow atlas, picked like
+// a cube map would.
+float getAtlasShadowFactor(vec4 pos, Light light, uint lightID) {
+    vec3 dir  = pos.xyz - light.position;
+    vec3 a    = abs(dir);
+    uint axis = (a.x >= a.y && a.x >= a.z) ? 0 : (a.y >= a.z ? 1 : 2);
+    uint face = axis * 2 + (dir[axis] < 0 ? 1 : 0);
+
+    vec4 clip = cubeFaces.data[lightID * 6 + face] * vec4(pos.xyz, 1);
+    return sampleShadowTile(light, face, clip.xyz / clip.w);
+}
+
+// Same projection as shadowmap.vert with PARABOLOID. The first half
+// looks down -Z, the second one is turned around Y to look down +Z.
+float getParaboloidShadowFactor(vec4 pos, Light light) {
+    vec3 p    = pos.xyz - light.position;
+    uint side = p.z <= 0 ? 0 : 1;
+    if (side == 1) {
+        p = vec3(-p.x, p.y, -p.z);
+    }
+    float len = length(p);
+    vec3  dir = p / len;
+    vec3  ndc = vec3(dir.xy / (1.0 - dir.z), (len - light.zNear) / (light.zFar - light.zNear));
+    return sampleShadowTile(light, side, ndc);
+}
+
+// Directions of the tetrahedron faces, same order as in Scene.cpp. The
+// face is the one the direction to the light is closest to.
+const vec3 TETRAHEDRON_FACES[4] = vec3[](
+    vec3( 1,  1,  1),
+    vec3( 1, -1, -1),
+    vec3(-1,  1, -1),
+    vec3(-1, -1,  1)
+);
+
+float getTetrahedralShadowFactor(vec4 pos, Light light, uint lightID) {
+    vec3  dir  = pos.xyz - light.position;
+    uint  face = 0;
+    float best = dot(dir, TETRAHEDRON_FACES[0]);
+    for (uint i = 1; i < 4; ++i) {
+        float d = dot(dir, TETRAHEDRON_FACES[i]);
+        if (d > best) {
+            best = d;
+            face = i;
+        }
+    }
+    vec4 clip = cubeFaces.data[lightID * 6 + face] * vec4(pos.xyz, 1);
+    return sampleShadowTile(light, face, clip.xyz / clip.w);
+}
+
+float getShadowFactor(vec4 pos, Light light, uint lightID) {
+    if (light.omniShadowMap == OMNI_SHADOW_MAP_DUAL_PARABOLOID) {
+        return getParaboloidShadowFactor(pos, light);
+    }
+    if (light.omniShadowMap == OMNI_SHADOW_MAP_TETRAHEDRAL) {
+        return getTetrahedralShadowFactor(pos, light, lightID);
+    }
+    if (light.shadowAtlas != 0) {
+        return getAtlasShadowFactor(pos, light, lightID);
+    }
     vec3 dir = pos.xyz - light.position;
 
     // Getting the cubemap face-specific depth and applying perspective
@@ -55,7 +125,7 @@ LightResult calculateLighting(vec4 pos, vec3 normal) {
         float diffuseFactor = max(0, dot(normal, normalizedDirectionToLight))
                             * falloff * light.intensity;
         if (USE_SHADOW_MAPS != 0) {
-            diffuseFactor *= 1.0 - getShadowFactor(pos, light);
+            diffuseFactor *= 1.0 - getShadowFactor(pos, light, i);
         }
         r.diffuse += light.diffuse * diffuseFactor;
         r.ambient += light.ambient * falloff;
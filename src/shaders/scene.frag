@@ -13,10 +13,12 @@
 layout (location = 0) in vec4 inPosition;
 layout (location = 1) in vec3 inNormal;
 layout (location = 2) in vec2 inTexCoord;
+layout (location = 3) flat in uint inDrawID;
 
 layout (location = 0) out vec4 outColor;
 
 void main() {
+    material = draws.data[inDrawID].material;
     LightResult lighting = calculateLighting(inPosition, inNormal);
 
     vec3 final = vec3(0,0,0);
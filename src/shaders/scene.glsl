@@ -7,10 +7,14 @@
 #ifndef SCENE_GLSL
 #define SCENE_GLSL
 
-#include "textures.glsl"
-
 #extension GL_EXT_buffer_reference : require
 
+// Compute shaders define SCENE_GLSL_DATA_ONLY to get just the data
+// structures, without textures and the graphics push constants.
+#ifndef SCENE_GLSL_DATA_ONLY
+#include "textures.glsl"
+#endif
+
 struct Light {
     vec3  position;
     float intensity;
@@ -20,8 +24,17 @@ struct Light {
     uint  shadowMap;
     float zNear;
     float zFar;
+    uint  shadowAtlas;   // Non-zero if shadowMap is the atlas
+    uint  omniShadowMap; // One of OMNI_SHADOW_MAP_*
+    vec4  atlasRects[6]; // Per face, scale (xy) and offset (zw) of the tile in atlas UVs
 };
 
+// Layouts of a light's shadow map. The faces of the last two are tiles of
+// a 2D texture at atlasRects, same as in the atlas.
+#define OMNI_SHADOW_MAP_CUBE            0
+#define OMNI_SHADOW_MAP_DUAL_PARABOLOID 1
+#define OMNI_SHADOW_MAP_TETRAHEDRAL     2
+
 layout(buffer_reference, std430) buffer Lights {
     Light data[];
 };
@@ -34,6 +47,23 @@ layout(buffer_reference, std430) buffer Material {
     uint  baseColorTID;
 };
 
+struct Meshlet {
+    vec3  center;        // Bounding sphere in mesh space
+    float radius;
+    vec3  coneApex;      // Backfacing if dot(normalize(coneApex - eye), coneAxis) >= coneCutoff
+    float coneCutoff;    // Above 1 for meshlets that can't be cone culled
+    vec3  coneAxis;
+    uint  firstTriangle; // Relative to the primitive group
+    uint  triangleCount;
+    uint  vertexCount;
+    uint  padding0;
+    uint  padding1;
+};
+
+layout(buffer_reference, std430) buffer Meshlets {
+    Meshlet data[];
+};
+
 layout(buffer_reference, std430) buffer Camera {
     vec3  eye;
     float fov;
@@ -48,14 +78,51 @@ layout(buffer_reference, std430) buffer Camera {
     mat4  projView;
 };
 
-layout (push_constant, std430) uniform PushConstants {
-    mat4     transform;
-    Camera   camera;
+struct NodeData {
+    mat4 transform; // Includes the dequantization of the mesh
+    vec4 boundsMin; // World space, w = 0 if the node has no bounds
+    vec4 boundsMax; // w = 1 if an animation moves the node
+};
+
+layout(buffer_reference, std430) buffer Nodes {
+    NodeData data[];
+};
+
+struct DrawData {
     Material material;
-    Lights   lights;
-    uint     lightCount;
-    uint     textureBaseIndex;   // Scene texture index allocation start
-    uint     currentLightID;     // Used only in shadowvolumes.geom
+    uint     nodeID;
+    uint     padding0;
+};
+
+layout(buffer_reference, std430) buffer Draws {
+    DrawData data[];
+};
+
+layout(buffer_reference, std430) buffer DrawIndices {
+    uint data[]; // Draw data index of each instance, indexed by gl_InstanceIndex.
 };
 
+layout(buffer_reference, std430) buffer CubeFaces {
+    mat4 data[]; // projView of the six faces of each light's cube shadow map, the first four if tetrahedral
+};
+
+#ifndef SCENE_GLSL_DATA_ONLY
+layout (push_constant, std430) uniform PushConstants {
+    Camera      camera;
+    Nodes       nodes;
+    Draws       draws;
+    DrawIndices drawIndices;
+    CubeFaces   cubeFaces;        // Used only with multiview and when sampling the atlas or tetrahedral maps
+    Lights      lights;
+    Meshlets    meshlets;         // Of all meshes, indexed by the groups' firstMeshlet
+    uint        lightCount;
+    uint        textureBaseIndex; // Scene texture index allocation start
+    uint        currentLightID;   // Used only in shadowvolumes.geom and multiview shadow maps
+};
+
+// Material of the current draw. Fragment shaders that use it set it from
+// the draw data first.
+Material material;
+#endif
+
 #endif
\ No newline at end of file
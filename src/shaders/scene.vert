@@ -7,18 +7,35 @@
 #version 450
 
 #include "scene.glsl"
+#include "constants.glsl"
 
 layout (location = 0) in vec3 aPosition;
-layout (location = 1) in vec3 aNormal;
+layout (location = 1) in vec4 aNormal; // xyz, or octahedral xy with PACKED_NORMALS
 layout (location = 2) in vec2 aTexCoord;
 
 layout (location = 0) out vec4 outPosition;
 layout (location = 1) out vec3 outNormal;
 layout (location = 2) out vec2 outTexCoord;
+layout (location = 3) flat out uint outDrawID;
+
+vec3 oct_decode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += (n.x >= 0.0) ? -t : t;
+    n.y += (n.y >= 0.0) ? -t : t;
+    return n;
+}
 
 void main() {
-    outNormal   = normalize(mat3(transpose(inverse(transform))) * aNormal); // For non-uniformly scaled transforms.
+    vec3 normal = (PACKED_NORMALS != 0U) ? oct_decode(aNormal.xy) : aNormal.xyz;
+    uint drawID = drawIndices.data[gl_InstanceIndex];
+    mat4 model  = nodes.data[draws.data[drawID].nodeID].transform;
+
+    // With quantized positions the transform also contains the mesh
+    // bounds, the stored normals are prescaled to cancel that out.
+    outNormal   = normalize(mat3(transpose(inverse(model))) * normal); // For non-uniformly scaled transforms.
     outTexCoord = aTexCoord;
-    outPosition = transform * vec4(aPosition, 1);
+    outDrawID   = drawID;
+    outPosition = model * vec4(aPosition, 1);
     gl_Position = camera.projView * outPosition;
 }
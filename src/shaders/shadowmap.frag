@@ -11,7 +11,9 @@
 #include "lighting.glsl"
 
 layout (location = 0) in vec2 inTexCoord;
+layout (location = 1) flat in uint inDrawID;
 void main() {
+    material = draws.data[inDrawID].material;
     if (ENABLE_ALPHA_TEST != 0) {
         sampleBaseColor(inTexCoord);
     }
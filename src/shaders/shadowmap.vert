@@ -4,15 +4,52 @@
 ///
 /// Vertex shader used for drawing to the shadow map.
 ///
+/// Built a second time with MULTIVIEW for drawing to all faces of a cube
+/// shadow map in one pass, the face matrix then comes from gl_ViewIndex.
+/// With PARABOLOID, draws one half of a dual-paraboloid shadow map. The
+/// camera view looks down the half's -Z from the light and depthNear/
+/// depthFar are the light's, positions are projected onto the paraboloid
+/// with linear depth and the other half is clipped away.
+/// With POSITION_ONLY, for opaque pipelines, only the position stream is
+/// read and there are no texcoords to pass on.
+///
 #version 450
+#if MULTIVIEW
+#extension GL_EXT_multiview : require
+#endif
+
 #include "scene.glsl"
 
 layout (location = 0) in  vec3 aPosition;
+#if !POSITION_ONLY
 layout (location = 1) in  vec2 aTexCoord;
+#endif
 
 layout (location = 0) out vec2 outTexCoord;
+layout (location = 1) flat out uint outDrawID;
 
 void main() {
+    uint drawID = drawIndices.data[gl_InstanceIndex];
+#if POSITION_ONLY
+    outTexCoord = vec2(0);
+#else
     outTexCoord = aTexCoord;
-    gl_Position = camera.projView * transform * vec4(aPosition, 1);
+#endif
+    outDrawID   = drawID;
+    vec4 world  = nodes.data[draws.data[drawID].nodeID].transform * vec4(aPosition, 1);
+
+#if PARABOLOID
+    vec3  p   = (camera.view * world).xyz;
+    float len = length(p);
+    vec3  dir = p / len;
+    gl_ClipDistance[0] = -dir.z;
+    gl_Position = vec4(dir.xy / max(1.0 - dir.z, 1e-5), (len - camera.depthNear) / (camera.depthFar - camera.depthNear), 1.0);
+#else
+#if MULTIVIEW
+    mat4 projView = cubeFaces.data[currentLightID * 6 + gl_ViewIndex];
+#else
+    mat4 projView = camera.projView;
+#endif
+    gl_Position = projView * world;
+#endif
 }
@@ -7,9 +7,14 @@
 #version 450
 #include "scene.glsl"
 
+// Quantized positions come in as [0, 1], the transform takes care of
+// scaling them back. The scene passes do the exact same math, so the
+// volumes still line up with the depth buffer.
 layout (location = 0) in  vec3 aPosition;
 layout (location = 0) out vec4 outPosition;
 void main() {
+    uint drawID    = drawIndices.data[gl_InstanceIndex];
+    mat4 transform = nodes.data[draws.data[drawID].nodeID].transform;
     outPosition = transform * vec4(aPosition, 1);
     gl_Position = camera.projView * outPosition;
 }
@@ -21,6 +21,14 @@ vec4 sampleTexture2D(uint index, uint samplerIndex, vec2 uv) {
     return texture(nonuniformEXT(sampler2D(textures[index], samplers[samplerIndex])), uv);
 }
 
+float sampleTexture2DShadow(uint index, uint samplerIndex, vec3 p) {
+    return texture(nonuniformEXT(sampler2DShadow(textures[index], samplers[samplerIndex])), p).x;
+}
+
+vec2 textureSize2D(uint index) {
+    return vec2(textureSize(textures[nonuniformEXT(index)], 0));
+}
+
 float sampleTextureCubeShadow(uint index, uint samplerIndex, vec4 p) {
     return texture(nonuniformEXT(samplerCubeShadow(textureCubes[index], samplers[samplerIndex])), p).x;
 }